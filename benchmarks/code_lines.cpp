@@ -0,0 +1,79 @@
+// Measures how quickly UICode splits content into lines, in MB/s.
+// Build and run with `./build.sh benchmark`. Build without -DUI_SSE2 and -DUI_AVX2 to compare against the scalar loop.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define UI_LINUX
+extern "C" {
+#define UI_FONT_PATH
+#define UI_IMPLEMENTATION
+#include "../luigi2.h"
+}
+
+#define CONTENT_BYTES (200 * 1024 * 1024)
+#define LINE_BYTES (41)
+#define RUNS (5)
+
+double Now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+int main() {
+	// Lines of source-like text, each ending with a newline.
+	char *content = (char *) malloc(CONTENT_BYTES);
+
+	for (size_t i = 0; i < CONTENT_BYTES; i++) {
+		content[i] = i % LINE_BYTES == LINE_BYTES - 1 ? '\n' : 'a' + i % 26;
+	}
+
+#if defined(UI_AVX2)
+	const char *path = "AVX2";
+#elif defined(UI_SSE2)
+	const char *path = "SSE2";
+#else
+	const char *path = "scalar";
+#endif
+
+	double bestScan = 1e9, bestIndex = 1e9;
+	size_t newlines = 0;
+	int lineCount = 0;
+
+	for (int run = 0; run < RUNS; run++) {
+		// Only finding the newlines.
+		double start = Now();
+		newlines = 0;
+
+		for (size_t i = _UICodeFindNewline(content, 0, CONTENT_BYTES); i < CONTENT_BYTES; i = _UICodeFindNewline(content, i + 1, CONTENT_BYTES)) {
+			newlines++;
+		}
+
+		double scan = Now() - start;
+		if (scan < bestScan) bestScan = scan;
+
+		// Building the line index, as done for inserted and mapped content.
+		UIWindow window = {};
+		UICode code = {};
+		code.e.window = &window;
+		code.content = content;
+		code.contentBytes = CONTENT_BYTES;
+		start = Now();
+		_UICodeIndexLines(&code, -1, CONTENT_BYTES);
+		double index = Now() - start;
+		if (index < bestIndex) bestIndex = index;
+		lineCount = code.lineCount;
+		free(code.lines);
+	}
+
+	double megabytes = CONTENT_BYTES / 1048576.0;
+	printf("Path: %s\n", path);
+	printf("Content: %.0f MB, %d lines of %d bytes (%zu newlines)\n", megabytes, lineCount, LINE_BYTES, newlines);
+	printf("Find newlines: %8.1f MB/s\n", megabytes / bestScan);
+	printf("Index lines:   %8.1f MB/s\n", megabytes / bestIndex);
+	free(content);
+	return 0;
+}
@@ -82,18 +82,64 @@ struct ProfProfilingEntry {
 	uint64_t timeStamp; // High bit set if exiting the function.
 };
 
+struct ProfProfilingChunk {
+	uint64_t threadID;
+	uint64_t timeStamp;
+	uint64_t bytes;
+	// Followed by the encoded events; see gf_profiling.c.
+};
+
+struct ProfEventDecoder {
+	const uint8_t *position, *end;
+	uint64_t timeStamp;
+	void **functionTable;
+	size_t functionCapacity;
+	uintptr_t functionIndex; // Of the last decoded event.
+};
+
+struct ProfProfilingThread {
+	uint64_t threadID;
+	Array<ProfProfilingChunk *> chunks;
+	Array<int> depthCounts; // The number of entries at each depth of the thread's lane.
+	int stackErrorCount;
+};
+
+struct ProfThreadLane {
+	uint64_t threadID;
+	int depth; // The row of the lane's header; its entries are placed below it.
+};
+
 struct ProfWindow {
-	uint64_t ticksPerMs;
 	UIFont *fontFlameGraph;
+	UICheckbox *loadHistoryOnStop;
+	UIButton *sampleButton;
 	bool inStepOverProfiled;
 };
 
+struct ProfSampledThread {
+	uint64_t threadID;
+	Array<void *> stack; // The start address of each function on the stack in the previous sample, from the outermost.
+	Array<uint8_t> events;
+	uint64_t lastTimeStamp;
+	bool seen; // In the current sample.
+};
+
+struct ProfSampler {
+	bool active, inSample;
+	int sampleCount;
+	ProfWindow *window;
+	Array<ProfSampledThread> threads;
+	Array<void *> functions;
+	MapShort<void *, uint32_t> functionIndices;
+};
+
 struct ProfFlameGraphEntry {
 	void *thisFunction;
 	const char *cName;
 	double startTime, endTime;
 	int depth;
 	uint8_t colorIndex;
+	uint8_t changeColorIndex[2]; // Into profChangeColorPalette, for the inclusive and exclusive time of the function.
 };
 
 struct ProfFlameGraphEntryTime {
@@ -102,6 +148,20 @@ struct ProfFlameGraphEntryTime {
 	int depth;
 };
 
+struct ProfFlameGraphLevel {
+	// Level 0 holds every entry. Each following level has double the bucket width of the previous,
+	// and merges neighbouring spans that are separated by less than a bucket, unless they are at least 4 buckets wide.
+	// A level is drawn when its buckets are narrower than a pixel, so a frame touches about as many spans as there are pixels in each row.
+	double bucketWidth;
+	Array<ProfFlameGraphEntryTime> times;
+	Array<uint32_t> entries; // The longest entry in each span, with PROF_LOD_MERGED set if the span merges several. Empty for level 0.
+	Array<int> depthStart; // The index of the first span at each depth.
+};
+
+#define PROF_LOD_MERGED (0x80000000)
+#define PROF_LOD_FINEST_BUCKETS (65536)
+#define PROF_LOD_COARSEST_BUCKETS (256)
+
 struct ProfSourceFileEntry {
 	char cPath[256];
 };
@@ -110,8 +170,46 @@ struct ProfFunctionEntry {
 	uint32_t callCount;
 	int lineNumber;
 	int sourceFileIndex;
-	double totalTime;
+	double totalTime, selfTime;
+	double baselineTotalTime, baselineSelfTime; // From the capture being compared against.
+	bool inBaseline;
+	char cName[64];
+};
+
+struct ProfSymbol {
+	int lineNumber;
 	char cName[64];
+	ProfSourceFileEntry sourceFile;
+};
+
+struct ProfCapture {
+	// The raw events of a capture, and everything needed to interpret them without the target.
+	uint64_t ticksPerMs;
+	Array<ProfProfilingChunk *> chunks;
+	void **functionTable;
+	size_t functionCapacity;
+	MapShort<void *, ProfSymbol> symbols;
+	bool live; // Missing symbols can be resolved by the debugger.
+	char *mapping; // The dump or capture file that the chunks point into.
+	size_t mappingBytes;
+	uint8_t *memory; // Or the events collected by the sampler.
+};
+
+// Saved captures start with this header, followed by the function table, the symbols, and the chunks.
+// Each chunk is padded to a multiple of 8 bytes. Everything is stored in the byte order of the machine that made the capture.
+#define PROF_CAPTURE_SIGNATURE ("GFPROF\0\0")
+#define PROF_CAPTURE_VERSION (1)
+
+struct ProfCaptureHeader {
+	char signature[8];
+	uint32_t version, headerBytes;
+	uint64_t ticksPerMs;
+	uint64_t functionCapacity, symbolCount, chunkCount;
+};
+
+struct ProfCaptureSymbol {
+	uint64_t address;
+	ProfSymbol symbol;
 };
 
 struct ProfFlameGraphReport {
@@ -120,14 +218,24 @@ struct ProfFlameGraphReport {
 	UIFont *font;
 	UITable *table;
 	UIButton *switchViewButton;
+	UIButton *colorModeButton;
 	UIScrollBar *vScroll;
 	bool showingTable;
 
+#define PROF_COLOR_SOURCE_FILE (0)
+#define PROF_COLOR_INCLUSIVE_CHANGE (1)
+#define PROF_COLOR_EXCLUSIVE_CHANGE (2)
+	int colorMode;
+	bool hasBaseline;
+
+	ProfCapture capture;
+
 	Array<ProfFlameGraphEntry> entries;
-	Array<ProfFlameGraphEntryTime> entryTimes;
+	Array<ProfFlameGraphLevel> levels;
 	Array<ProfFunctionEntry> sortedFunctions;
 	MapShort<void *, ProfFunctionEntry> functions;
 	Array<ProfSourceFileEntry> sourceFiles;
+	Array<ProfThreadLane> lanes;
 
 	uint32_t *thumbnail;
 	int thumbnailWidth, thumbnailHeight;
@@ -170,24 +278,74 @@ const uint32_t profEntryColorPalette[] = {
 	0xFFD7E5A0, 0xFFE5A4A0, 0xFFDEA0E5, 0xFFA0B1E5, 0xFFA0E5C9, 0xFFC6E5A0, 0xFFE5B5A0, 0xFFE5A0DB,
 };
 
+// From faster to slower than the baseline, with no change in the middle.
+const uint32_t profChangeColorPalette[] = {
+	0xFF6098E8, 0xFF6E9FE5, 0xFF7CA6E2, 0xFF8AADDF, 0xFF98B4DC, 0xFFA6BBD9, 0xFFB4C2D6, 0xFFC2C9D3, 0xFFD0D0D0,
+	0xFFD3C1C1, 0xFFD6B2B2, 0xFFD9A3A3, 0xFFDC9494, 0xFFDF8585, 0xFFE27676, 0xFFE56767, 0xFFE85858,
+};
+
 const int profZoomBarHeight = 30;
 const int profScaleHeight = 20;
 const int profRowHeight = 30;
 
-#define PROF_MAX_RENDER_THREAD_COUNT (8)
-pthread_t profRenderThreads[PROF_MAX_RENDER_THREAD_COUNT];
-sem_t profRenderStartSemaphores[PROF_MAX_RENDER_THREAD_COUNT];
+struct ProfRenderQueue {
+	// The owning thread takes items from the front, and other threads steal from the back.
+	volatile uint64_t range; // (front << 32) | back
+	char padding[56]; // Keep each queue on its own cache line.
+};
+
+// Each frame is divided into work items, one for each visible row in each tile of PROF_RENDER_TILE_WIDTH pixels.
+// The items are split evenly between the threads' queues, and threads that run out of work steal from the others.
+#define PROF_RENDER_TILE_WIDTH (128)
+pthread_t *profRenderThreads;
+sem_t *profRenderStartSemaphores;
+ProfRenderQueue *profRenderQueues;
 sem_t profRenderEndSemaphore;
 UIPainter *volatile profRenderPainter;
 ProfFlameGraphReport *volatile profRenderReport;
+ProfFlameGraphLevel *volatile profRenderLevel;
+int profRenderFirstDepth, profRenderTileCount, profRenderTileLeft;
 int profRenderThreadCount;
 volatile int profRenderThreadIndexAllocator;
 volatile int profRenderActiveThreads;
 
-int ProfFlameGraphEntryCompare(const void *_a, const void *_b) {
-	ProfFlameGraphEntry *a = (ProfFlameGraphEntry *) _a;
-	ProfFlameGraphEntry *b = (ProfFlameGraphEntry *) _b;
-	return a->depth > b->depth ? 1 : a->depth < b->depth ? -1 : a->startTime > b->startTime ? 1 : a->startTime < b->startTime ? -1 : 0;
+// Symbols resolved in earlier captures, reused while the loaded object files are unchanged.
+#define PROF_SYMBOLIZE_BATCH (256)
+MapShort<void *, ProfSymbol> profSymbolCache;
+uint64_t profSymbolBuildID;
+
+// In sampling mode, the target is interrupted every PROF_SAMPLE_INTERVAL_MS, and the stacks of all its threads are collected.
+// Each round trip to the debugger takes PROF_SAMPLE_BATCH_MS worth of samples, which keeps it well within the evaluation timeout.
+#define PROF_SAMPLE_INTERVAL_MS (10)
+#define PROF_SAMPLE_BATCH_MS (200)
+ProfSampler profSampler;
+UIMessage msgProfSample;
+
+void ProfCaptureFree(ProfCapture *capture) {
+	if (capture->mapping) UnmapFile(capture->mapping, capture->mappingBytes);
+	free(capture->memory);
+	capture->chunks.Free();
+	capture->symbols.Free();
+	free(capture->functionTable);
+	*capture = {};
+}
+
+void ProfReportFree(ProfFlameGraphReport *report) {
+	report->entries.Free();
+	report->functions.Free();
+	report->sourceFiles.Free();
+
+	for (int i = 0; i < report->levels.Length(); i++) {
+		report->levels[i].times.Free();
+		report->levels[i].entries.Free();
+		report->levels[i].depthStart.Free();
+	}
+
+	report->levels.Free();
+	report->lanes.Free();
+	report->sortedFunctions.Free();
+	ProfCaptureFree(&report->capture);
+	free(report->thumbnail);
 }
 
 void ProfShowSource(void *_report) {
@@ -246,84 +404,133 @@ void ProfDrawTransparentOverlay(UIPainter *painter, UIRectangle rectangle, uint3
 	int64_t rt = report->client.t + time->depth * profRowHeight + profScaleHeight - report->vScroll->position; \
 	int64_t rb = rt + profRowHeight;
 
-void *ProfFlameGraphRenderThread(void *_unused) {
-	(void) _unused;
-	int threadIndex = __sync_fetch_and_add(&profRenderThreadIndexAllocator, 1);
+ProfFlameGraphLevel *ProfFlameGraphSelectLevel(ProfFlameGraphReport *report, double zoomX) {
+	ProfFlameGraphLevel *level = &report->levels[0];
 
-	while (true) {
-		sem_wait(&profRenderStartSemaphores[threadIndex]);
+	for (int i = 1; i < report->levels.Length(); i++) {
+		if (report->levels[i].bucketWidth * zoomX > 1.0) break;
+		level = &report->levels[i];
+	}
 
-		ProfFlameGraphReport *report = profRenderReport;
-		UIElement *element = &report->e;
+	return level;
+}
 
-		double zoomX = (double) UI_RECT_WIDTH(report->client) / (report->xEnd - report->xStart);
-		UIPainter _painter = *profRenderPainter; // Some of the draw functions modify the painter's clip, so make a copy.
-		UIPainter *painter = &_painter;
+int ProfFlameGraphLevelFind(ProfFlameGraphLevel *level, int depth, float time) {
+	// Spans at the same depth never overlap, so they are sorted by both their start and end times.
+	int low = level->depthStart[depth], high = level->depthStart[depth + 1];
 
-		int64_t pr = 0, pd = 0;
-		float xStartF = (float) report->xStart;
-		float xEndF = (float) report->xEnd;
+	while (low < high) {
+		int middle = (low + high) / 2;
+		if (level->times[middle].end < time) low = middle + 1;
+		else high = middle;
+	}
 
-		int startIndex = report->entries.Length() / profRenderThreadIndexAllocator * threadIndex;
-		int endIndex = report->entries.Length() / profRenderThreadIndexAllocator * (threadIndex + 1);
+	return low;
+}
 
-		if (profRenderThreadCount == threadIndex + 1) {
-			endIndex = report->entries.Length();
-		}
+void ProfFlameGraphRenderDepth(ProfFlameGraphReport *report, UIPainter *painter, ProfFlameGraphLevel *level, 
+		int depth, double zoomX, float xStartF, float xEndF) {
+	UIElement *element = &report->e;
+	int64_t pr = 0, pd = 0;
+	int endIndex = level->depthStart[depth + 1];
 
-		// printf("render on thread %d from %d to %d\n", threadIndex, startIndex, endIndex);
+	for (int i = ProfFlameGraphLevelFind(level, depth, xStartF); i < endIndex; i++) {
+		ProfFlameGraphEntryTime *time = &level->times[i];
 
-		for (int i = startIndex; i < endIndex; i++) {
-			ProfFlameGraphEntryTime *time = &report->entryTimes[i];
+		if (time->start > xEndF) {
+			break;
+		}
 
-			if (time->end < xStartF || time->start > xEndF) {
-				continue;
-			}
+		PROFILER_ENTRY_RECTANGLE_EARLY();
 
-			PROFILER_ENTRY_RECTANGLE_EARLY();
+		if (pr == rr && pd == time->depth) {
+			continue;
+		}
 
-			if (pr == rr && pd == time->depth) {
-				continue;
+		uint32_t entryIndex = level->entries.Length() ? level->entries[i] : i;
+		ProfFlameGraphEntry *entry = &report->entries[entryIndex & ~PROF_LOD_MERGED];
+		PROFILER_ENTRY_RECTANGLE_OTHER();
+
+		if (rl <= painter->clip.r && rr >= painter->clip.l && rt <= element->clip.b && rb >= element->clip.t) {
+			// Carefully convert 64-bit integers to 32-bit integers for UIRectangle,
+			// since the rectangle may be really large when zoomed in.
+			UIRectangle r;
+			r.l = rl < report->client.l ? report->client.l : rl;
+			r.r = rr > report->client.r ? report->client.r : rr;
+			r.t = rt < report->client.t ? report->client.t : rt;
+			r.b = rb > report->client.b ? report->client.b : rb;
+
+			UIDrawBlock(painter, UI_RECT_4(r.r - 1, r.r, r.t, r.b - 1), profBorderDarkColor);
+			UIDrawBlock(painter, UI_RECT_4(r.l, r.r, r.b - 1, r.b), profBorderDarkColor);
+			UIDrawBlock(painter, UI_RECT_4(r.l, r.r - 1, r.t, r.t + 1), profBorderLightColor);
+			UIDrawBlock(painter, UI_RECT_4(r.l, r.l + 1, r.t + 1, r.b - 1), profBorderLightColor);
+
+			bool hovered = report->hover && report->hover->thisFunction == entry->thisFunction && !report->dragMode;
+			uint32_t color = hovered ? profHoverColor 
+				: report->colorMode == PROF_COLOR_SOURCE_FILE ? profEntryColorPalette[entry->colorIndex]
+				: profChangeColorPalette[entry->changeColorIndex[report->colorMode - 1]];
+			/// uint32_t color = hovered ? profHoverColor : profMainColor;
+			UIDrawBlock(painter, UI_RECT_4(r.l + 1, r.r - 1, r.t + 1, r.b - 1), color);
+
+			if (UI_RECT_WIDTH(r) > 40 && (~entryIndex & PROF_LOD_MERGED)) {
+				char string[128];
+				StringFormat(string, sizeof(string), "%s %fms", entry->cName, entry->endTime - entry->startTime);
+				UIDrawString(painter, UI_RECT_4(r.l + 2, r.r, r.t, r.b), string, -1, profTextColor, UI_ALIGN_LEFT, NULL);
 			}
+		}
 
-			ProfFlameGraphEntry *entry = &report->entries[i];
-			PROFILER_ENTRY_RECTANGLE_OTHER();
+		pr = rr, pd = entry->depth;
 
-			if (rl <= element->clip.r && rr >= element->clip.l && rt <= element->clip.b && rb >= element->clip.t) {
-				// Carefully convert 64-bit integers to 32-bit integers for UIRectangle,
-				// since the rectangle may be really large when zoomed in.
-				UIRectangle r;
-				r.l = rl < report->client.l ? report->client.l : rl;
-				r.r = rr > report->client.r ? report->client.r : rr;
-				r.t = rt < report->client.t ? report->client.t : rt;
-				r.b = rb > report->client.b ? report->client.b : rb;
-
-				UIDrawBlock(painter, UI_RECT_4(r.r - 1, r.r, r.t, r.b - 1), profBorderDarkColor);
-				UIDrawBlock(painter, UI_RECT_4(r.l, r.r, r.b - 1, r.b), profBorderDarkColor);
-				UIDrawBlock(painter, UI_RECT_4(r.l, r.r - 1, r.t, r.t + 1), profBorderLightColor);
-				UIDrawBlock(painter, UI_RECT_4(r.l, r.l + 1, r.t + 1, r.b - 1), profBorderLightColor);
-
-				bool hovered = report->hover && report->hover->thisFunction == entry->thisFunction && !report->dragMode;
-				uint32_t color = hovered ? profHoverColor : profEntryColorPalette[entry->colorIndex];
-				/// uint32_t color = hovered ? profHoverColor : profMainColor;
-				UIDrawBlock(painter, UI_RECT_4(r.l + 1, r.r - 1, r.t + 1, r.b - 1), color);
-
-				if (UI_RECT_WIDTH(r) > 40) {
-					char string[128];
-					StringFormat(string, sizeof(string), "%s %fms", entry->cName, entry->endTime - entry->startTime);
-					UIDrawString(painter, UI_RECT_4(r.l + 2, r.r, r.t, r.b), string, -1, profTextColor, UI_ALIGN_LEFT, NULL);
-				}
+		float nextDrawTime = 0.99f / zoomX + time->end;
+
+		for (; i < endIndex; i++) {
+			if (level->times[i].end >= nextDrawTime) {
+				i--;
+				break;
 			}
+		}
+	}
+}
+
+bool ProfRenderQueueTake(ProfRenderQueue *queue, bool steal, int *item) {
+	while (true) {
+		uint64_t range = __atomic_load_n(&queue->range, __ATOMIC_ACQUIRE);
+		uint32_t front = range >> 32, back = (uint32_t) range;
+		if (front >= back) return false;
+		uint64_t next = steal ? ((uint64_t) front << 32) | (back - 1) : ((uint64_t) (front + 1) << 32) | back;
+
+		if (__atomic_compare_exchange_n(&queue->range, &range, next, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			*item = steal ? back - 1 : front;
+			return true;
+		}
+	}
+}
 
-			pr = rr, pd = entry->depth;
+void *ProfFlameGraphRenderThread(void *_unused) {
+	(void) _unused;
+	int threadIndex = __sync_fetch_and_add(&profRenderThreadIndexAllocator, 1);
 
-			float nextDrawTime = 0.99f / zoomX + time->end;
+	while (true) {
+		sem_wait(&profRenderStartSemaphores[threadIndex]);
 
-			for (; i < report->entries.Length(); i++) {
-				if (report->entryTimes[i].end >= nextDrawTime || report->entryTimes[i].depth != time->depth) {
-					i--;
-					break;
-				}
+		ProfFlameGraphReport *report = profRenderReport;
+		ProfFlameGraphLevel *level = profRenderLevel;
+		double zoomX = (double) UI_RECT_WIDTH(report->client) / (report->xEnd - report->xStart);
+		int item;
+
+		for (int i = 0; i < profRenderThreadCount; i++) {
+			ProfRenderQueue *queue = &profRenderQueues[(threadIndex + i) % profRenderThreadCount];
+
+			while (ProfRenderQueueTake(queue, i != 0, &item)) {
+				int depth = profRenderFirstDepth + item / profRenderTileCount;
+				int tileLeft = profRenderTileLeft + item % profRenderTileCount * PROF_RENDER_TILE_WIDTH;
+				UIPainter painter = *profRenderPainter; // Some of the draw functions modify the painter's clip, so make a copy.
+				painter.clip = UIRectangleIntersection(painter.clip, UI_RECT_4(tileLeft, tileLeft + PROF_RENDER_TILE_WIDTH, painter.clip.t, painter.clip.b));
+				float startTime = (tileLeft - 1 - report->client.l) / zoomX + report->xStart;
+				float endTime = (tileLeft + PROF_RENDER_TILE_WIDTH + 1 - report->client.l) / zoomX + report->xStart;
+				if (startTime < (float) report->xStart) startTime = report->xStart;
+				if (endTime > (float) report->xEnd) endTime = report->xEnd;
+				ProfFlameGraphRenderDepth(report, &painter, level, depth, zoomX, startTime, endTime);
 			}
 		}
 
@@ -345,11 +552,13 @@ int ProfFlameGraphMessage(UIElement *element, UIMessage message, int di, void *d
 		double zoomX = (double) UI_RECT_WIDTH(report->client) / (report->xEnd - report->xStart);
 
 		if (!profRenderThreadCount) {
-			profRenderThreadCount = sysconf(_SC_NPROCESSORS_CONF);
+			profRenderThreadCount = sysconf(_SC_NPROCESSORS_ONLN);
 			if (profRenderThreadCount < 1) profRenderThreadCount = 1;
-			if (profRenderThreadCount > PROF_MAX_RENDER_THREAD_COUNT) profRenderThreadCount = PROF_MAX_RENDER_THREAD_COUNT;
 			printf("Using %d render threads.\n", profRenderThreadCount);
 
+			profRenderThreads = (pthread_t *) calloc(profRenderThreadCount, sizeof(pthread_t));
+			profRenderStartSemaphores = (sem_t *) calloc(profRenderThreadCount, sizeof(sem_t));
+			profRenderQueues = (ProfRenderQueue *) aligned_alloc(64, profRenderThreadCount * sizeof(ProfRenderQueue));
 			sem_init(&profRenderEndSemaphore, 0, 0);
 
 			for (int i = 0; i < profRenderThreadCount; i++) {
@@ -361,14 +570,44 @@ int ProfFlameGraphMessage(UIElement *element, UIMessage message, int di, void *d
 		UIPainter *painter = (UIPainter *) dp;
 		UIDrawBlock(painter, report->client, profBackgroundColor);
 
+		ProfFlameGraphLevel *level = ProfFlameGraphSelectLevel(report, zoomX);
+		int depthCount = level->depthStart.Length() - 1;
+		UIRectangle bounds = UIRectangleIntersection(painter->clip, report->client);
+		int firstDepth = (bounds.t - report->client.t - profScaleHeight + report->vScroll->position) / profRowHeight - 1;
+		int lastDepth = (bounds.b - report->client.t - profScaleHeight + report->vScroll->position) / profRowHeight + 1;
+		if (firstDepth < 0) firstDepth = 0;
+		if (lastDepth > depthCount) lastDepth = depthCount;
+		int tileCount = UI_RECT_VALID(bounds) ? (UI_RECT_WIDTH(bounds) + PROF_RENDER_TILE_WIDTH - 1) / PROF_RENDER_TILE_WIDTH : 0;
+		int itemCount = lastDepth > firstDepth ? (lastDepth - firstDepth) * tileCount : 0;
+
+		for (int i = 0; i < profRenderThreadCount; i++) {
+			uint64_t front = (uint64_t) itemCount * i / profRenderThreadCount;
+			uint64_t back = (uint64_t) itemCount * (i + 1) / profRenderThreadCount;
+			profRenderQueues[i].range = (front << 32) | back;
+		}
+
 		profRenderReport = report;
 		profRenderPainter = painter;
+		profRenderLevel = level;
+		profRenderFirstDepth = firstDepth;
+		profRenderTileCount = tileCount ? tileCount : 1;
+		profRenderTileLeft = bounds.l;
 		profRenderActiveThreads = profRenderThreadCount;
 		__sync_synchronize();
 		for (int i = 0; i < profRenderThreadCount; i++) sem_post(&profRenderStartSemaphores[i]);
 		for (int i = 0; i < profRenderThreadCount; i++) sem_wait(&profRenderEndSemaphore);
 		assert(!__sync_fetch_and_sub(&profRenderActiveThreads, 1));
 
+		for (int i = 0; i < report->lanes.Length(); i++) {
+			int rt = report->client.t + report->lanes[i].depth * profRowHeight + profScaleHeight - report->vScroll->position;
+			UIRectangle r = UI_RECT_4(report->client.l, report->client.r, rt, rt + profRowHeight);
+			if (!UI_RECT_VALID(UIRectangleIntersection(r, painter->clip))) continue;
+			char string[64];
+			StringFormat(string, sizeof(string), "Thread %lu", report->lanes[i].threadID);
+			UIDrawRectangle(painter, r, profBackgroundColor, profBorderDarkColor, UI_RECT_4(0, 0, 0, 1));
+			UIDrawString(painter, UI_RECT_4(r.l + 4, r.r, r.t, r.b), string, -1, profBorderLightColor, UI_ALIGN_LEFT, NULL);
+		}
+
 		{
 			UIRectangle r = UI_RECT_4(report->client.l, report->client.r, report->client.t, report->client.t + profScaleHeight);
 			UIDrawRectangle(painter, r, profMainColor, profBorderDarkColor, UI_RECT_4(0, 0, 0, 1));
@@ -425,21 +664,32 @@ int ProfFlameGraphMessage(UIElement *element, UIMessage message, int di, void *d
 		if (report->hover && !report->dragMode) {
 			ProfFunctionEntry function = report->functions.Get(report->hover->thisFunction);
 
-			char line1[256], line2[256], line3[256];
+			char line1[256], line2[256], line3[256], line4[256];
 			StringFormat(line1, sizeof(line1), "[%s] %s:%d", report->hover->cName, 
 					function.sourceFileIndex != -1 ? report->sourceFiles[function.sourceFileIndex].cPath : "??",
 					function.lineNumber);
 			StringFormat(line2, sizeof(line2), "This call: %fms %.1f%%",
 					report->hover->endTime - report->hover->startTime, (report->hover->endTime - report->hover->startTime) / report->totalTime * 100.0);
-			StringFormat(line3, sizeof(line3), "Total: %fms in %d calls (%fms avg) %.1f%%", 
-					function.totalTime, function.callCount, function.totalTime / function.callCount, function.totalTime / report->totalTime * 100.0);
+			StringFormat(line3, sizeof(line3), "Total: %fms in %d calls (%fms avg) %.1f%%, %fms self", 
+					function.totalTime, function.callCount, function.totalTime / function.callCount, function.totalTime / report->totalTime * 100.0,
+					function.selfTime);
+
+			if (!report->hasBaseline) {
+				line4[0] = 0;
+			} else if (!function.inBaseline) {
+				StringFormat(line4, sizeof(line4), "Not in baseline");
+			} else {
+				StringFormat(line4, sizeof(line4), "Change from baseline: %+fms total, %+fms self", 
+						function.totalTime - function.baselineTotalTime, function.selfTime - function.baselineSelfTime);
+			}
 
 			int width = 0;
 			int line1Width = UIMeasureStringWidth(line1, -1); if (width < line1Width) width = line1Width;
 			int line2Width = UIMeasureStringWidth(line2, -1); if (width < line2Width) width = line2Width;
 			int line3Width = UIMeasureStringWidth(line3, -1); if (width < line3Width) width = line3Width;
+			int line4Width = UIMeasureStringWidth(line4, -1); if (width < line4Width) width = line4Width;
 			int lineHeight = UIMeasureStringHeight();
-			int height = 3 * lineHeight;
+			int height = (line4[0] ? 4 : 3) * lineHeight;
 			int x = element->window->cursorX;
 			if (x + width > element->clip.r) x = element->clip.r - width;
 			int y = element->window->cursorY + 25;
@@ -450,6 +700,7 @@ int ProfFlameGraphMessage(UIElement *element, UIMessage message, int di, void *d
 			UIDrawString(painter, UI_RECT_4(x, x + width, y + lineHeight * 0, y + lineHeight * 1), line1, -1, 0xFFFFFFFF, UI_ALIGN_LEFT, 0);
 			UIDrawString(painter, UI_RECT_4(x, x + width, y + lineHeight * 1, y + lineHeight * 2), line2, -1, 0xFFFFFFFF, UI_ALIGN_LEFT, 0);
 			UIDrawString(painter, UI_RECT_4(x, x + width, y + lineHeight * 2, y + lineHeight * 3), line3, -1, 0xFFFFFFFF, UI_ALIGN_LEFT, 0);
+			UIDrawString(painter, UI_RECT_4(x, x + width, y + lineHeight * 3, y + lineHeight * 4), line4, -1, 0xFFFFFFFF, UI_ALIGN_LEFT, 0);
 		}
 
 		UIFontActivate(previousFont);
@@ -460,22 +711,31 @@ int ProfFlameGraphMessage(UIElement *element, UIMessage message, int di, void *d
 		float xStartF = (float) report->xStart;
 		float xEndF = (float) report->xEnd;
 
-		for (int i = 0; i < report->entries.Length(); i++) {
-			ProfFlameGraphEntryTime *time = &report->entryTimes[i];
+		ProfFlameGraphLevel *level = &report->levels[0];
 
-			if (time->depth != depth || time->end < xStartF || time->start > xEndF) {
-				continue;
-			}
+		if (depth >= 0 && depth < level->depthStart.Length() - 1) {
+			float cursorTime = (element->window->cursorX - report->client.l - 1) / zoomX + report->xStart;
+			int endIndex = level->depthStart[depth + 1];
 
-			PROFILER_ENTRY_RECTANGLE_EARLY();
-			PROFILER_ENTRY_RECTANGLE_OTHER();
+			for (int i = ProfFlameGraphLevelFind(level, depth, cursorTime < xStartF ? xStartF : cursorTime); i < endIndex; i++) {
+				ProfFlameGraphEntryTime *time = &level->times[i];
 
-			(void) rt;
-			(void) rb;
+				if (time->start > xEndF) {
+					break;
+				}
 
-			if (element->window->cursorX >= rl && element->window->cursorX < rr) {
-				hover = &report->entries[i];
-				break;
+				PROFILER_ENTRY_RECTANGLE_EARLY();
+				PROFILER_ENTRY_RECTANGLE_OTHER();
+
+				(void) rt;
+				(void) rb;
+
+				if (element->window->cursorX >= rl && element->window->cursorX < rr) {
+					hover = &report->entries[i];
+					break;
+				} else if (rl > element->window->cursorX) {
+					break;
+				}
 			}
 		}
 
@@ -611,11 +871,7 @@ int ProfFlameGraphMessage(UIElement *element, UIMessage message, int di, void *d
 	} else if (message == UI_MSG_SCROLLED) {
 		UIElementRefresh(element);
 	} else if (message == UI_MSG_DESTROY) {
-		report->entries.Free();
-		report->functions.Free();
-		report->sourceFiles.Free();
-		report->entryTimes.Free();
-		free(report->thumbnail);
+		ProfReportFree(report);
 	}
 
 	return 0;
@@ -643,6 +899,22 @@ void ProfSwitchView(void *_report) {
 	UIElementRefresh(report->e.parent);
 }
 
+void ProfSwitchColorMode(void *_report) {
+	ProfFlameGraphReport *report = (ProfFlameGraphReport *) _report;
+
+	if (!report->hasBaseline) {
+		UIDialogShow(windowMain, 0, "Compare with a saved capture to color by the change in time.\n%f%b", "OK");
+		return;
+	}
+
+	report->colorMode = (report->colorMode + 1) % 3;
+	const char *label = report->colorMode == PROF_COLOR_INCLUSIVE_CHANGE ? "Color by change in time" 
+		: report->colorMode == PROF_COLOR_EXCLUSIVE_CHANGE ? "Color by change in self time" : "Color by source file";
+	UI_FREE(report->colorModeButton->label);
+	report->colorModeButton->label = UIStringCopy(label, (report->colorModeButton->labelBytes = -1));
+	UIElementRefresh(report->e.parent);
+}
+
 #define PROF_FUNCTION_COMPARE(a, b) \
        int a(const void *c, const void *d) { \
 	       const ProfFunctionEntry *left = (const ProfFunctionEntry *) c; \
@@ -654,9 +926,11 @@ void ProfSwitchView(void *_report) {
 
 PROF_FUNCTION_COMPARE(ProfFunctionCompareName, strcmp(left->cName, right->cName));
 PROF_FUNCTION_COMPARE(ProfFunctionCompareTotalTime, PROF_COMPARE_NUMBERS(left->totalTime, right->totalTime));
+PROF_FUNCTION_COMPARE(ProfFunctionCompareSelfTime, PROF_COMPARE_NUMBERS(left->selfTime, right->selfTime));
 PROF_FUNCTION_COMPARE(ProfFunctionCompareCallCount, PROF_COMPARE_NUMBERS(left->callCount, right->callCount));
 PROF_FUNCTION_COMPARE(ProfFunctionCompareAverage, PROF_COMPARE_NUMBERS(left->totalTime / left->callCount, right->totalTime / right->callCount));
-PROF_FUNCTION_COMPARE(ProfFunctionComparePercentage, PROF_COMPARE_NUMBERS(left->totalTime, right->totalTime));
+PROF_FUNCTION_COMPARE(ProfFunctionCompareTotalTimeChange, PROF_COMPARE_NUMBERS(left->totalTime - left->baselineTotalTime, right->totalTime - right->baselineTotalTime));
+PROF_FUNCTION_COMPARE(ProfFunctionCompareSelfTimeChange, PROF_COMPARE_NUMBERS(left->selfTime - left->baselineSelfTime, right->selfTime - right->baselineSelfTime));
 
 int ProfTableMessage(UIElement *element, UIMessage message, int di, void *dp) {
 	ProfFlameGraphReport *report = (ProfFlameGraphReport *) element->cp;
@@ -671,11 +945,15 @@ int ProfTableMessage(UIElement *element, UIMessage message, int di, void *dp) {
 		} else if (m->column == 1) {
 			return StringFormat(m->buffer, m->bufferBytes, "%f", entry->totalTime);
 		} else if (m->column == 2) {
-			return StringFormat(m->buffer, m->bufferBytes, "%d", entry->callCount);
+			return StringFormat(m->buffer, m->bufferBytes, "%f", entry->selfTime);
 		} else if (m->column == 3) {
-			return StringFormat(m->buffer, m->bufferBytes, "%f", entry->totalTime / entry->callCount);
+			return StringFormat(m->buffer, m->bufferBytes, "%d", entry->callCount);
 		} else if (m->column == 4) {
-			return StringFormat(m->buffer, m->bufferBytes, "%f", entry->totalTime / report->totalTime * 100);
+			return StringFormat(m->buffer, m->bufferBytes, "%f", entry->totalTime / entry->callCount);
+		} else if (m->column == 5) {
+			return StringFormat(m->buffer, m->bufferBytes, entry->inBaseline ? "%+f" : "new", entry->totalTime - entry->baselineTotalTime);
+		} else if (m->column == 6) {
+			return StringFormat(m->buffer, m->bufferBytes, entry->inBaseline ? "%+f" : "new", entry->selfTime - entry->baselineSelfTime);
 		}
 	} else if (message == UI_MSG_LEFT_DOWN) {
 		int index = UITableHeaderHitTest(table, element->window->cursorX, element->window->cursorY);
@@ -686,11 +964,15 @@ int ProfTableMessage(UIElement *element, UIMessage message, int di, void *dp) {
 			} else if (index == 1) {
 				qsort(report->sortedFunctions.array, report->sortedFunctions.Length(), sizeof(ProfFunctionEntry), ProfFunctionCompareTotalTime);
 			} else if (index == 2) {
-				qsort(report->sortedFunctions.array, report->sortedFunctions.Length(), sizeof(ProfFunctionEntry), ProfFunctionCompareCallCount);
+				qsort(report->sortedFunctions.array, report->sortedFunctions.Length(), sizeof(ProfFunctionEntry), ProfFunctionCompareSelfTime);
 			} else if (index == 3) {
-				qsort(report->sortedFunctions.array, report->sortedFunctions.Length(), sizeof(ProfFunctionEntry), ProfFunctionCompareAverage);
+				qsort(report->sortedFunctions.array, report->sortedFunctions.Length(), sizeof(ProfFunctionEntry), ProfFunctionCompareCallCount);
 			} else if (index == 4) {
-				qsort(report->sortedFunctions.array, report->sortedFunctions.Length(), sizeof(ProfFunctionEntry), ProfFunctionComparePercentage);
+				qsort(report->sortedFunctions.array, report->sortedFunctions.Length(), sizeof(ProfFunctionEntry), ProfFunctionCompareAverage);
+			} else if (index == 5) {
+				qsort(report->sortedFunctions.array, report->sortedFunctions.Length(), sizeof(ProfFunctionEntry), ProfFunctionCompareTotalTimeChange);
+			} else if (index == 6) {
+				qsort(report->sortedFunctions.array, report->sortedFunctions.Length(), sizeof(ProfFunctionEntry), ProfFunctionCompareSelfTimeChange);
 			}
 
 			UIElementRefresh(element);
@@ -703,262 +985,1001 @@ int ProfTableMessage(UIElement *element, UIMessage message, int di, void *dp) {
 	return 0;
 }
 
-void ProfLoadProfileData(void *_window) {
-	ProfWindow *data = (ProfWindow *) _window;
+void ProfFlameGraphIndexDepths(ProfFlameGraphLevel *level, int maxDepth) {
+	for (int depth = 0, i = 0; depth <= maxDepth + 1; depth++) {
+		while (i < level->times.Length() && level->times[i].depth < depth) i++;
+		level->depthStart.Add(i);
+	}
+}
 
-	const char *ticksPerMsString = EvaluateExpression("gfProfilingTicksPerMs");
-	ticksPerMsString = ticksPerMsString ? strstr(ticksPerMsString, "= ") : nullptr;
-	data->ticksPerMs = ticksPerMsString ? atoi(ticksPerMsString + 2) : 0;
+void ProfFlameGraphBuildLevels(ProfFlameGraphReport *report, int maxDepth) {
+	ProfFlameGraphIndexDepths(&report->levels[0], maxDepth);
+
+	for (double bucketWidth = report->totalTime / PROF_LOD_FINEST_BUCKETS; 
+			report->totalTime / bucketWidth >= PROF_LOD_COARSEST_BUCKETS; bucketWidth *= 2) {
+		ProfFlameGraphLevel level = {};
+		level.bucketWidth = bucketWidth;
+		ProfFlameGraphLevel *previous = &report->levels.Last();
+		bool lastMergeable = false;
+
+		for (int i = 0; i < previous->times.Length(); i++) {
+			ProfFlameGraphEntryTime time = previous->times[i];
+			uint32_t entryIndex = previous->entries.Length() ? previous->entries[i] : i;
+			bool large = (~entryIndex & PROF_LOD_MERGED) && time.end - time.start >= 4 * bucketWidth;
+
+			if (!large && lastMergeable && level.times.Last().depth == time.depth && time.start - level.times.Last().end < bucketWidth) {
+				ProfFlameGraphEntry *longest = &report->entries[level.entries.Last() & ~PROF_LOD_MERGED];
+				ProfFlameGraphEntry *entry = &report->entries[entryIndex & ~PROF_LOD_MERGED];
+				if (entry->endTime - entry->startTime > longest->endTime - longest->startTime) level.entries.Last() = entryIndex;
+				level.entries.Last() |= PROF_LOD_MERGED;
+				if (time.end > level.times.Last().end) level.times.Last().end = time.end;
+			} else {
+				level.times.Add(time);
+				level.entries.Add(entryIndex);
+				lastMergeable = !large;
+			}
+		}
 
-	if (!ticksPerMsString || !data->ticksPerMs) {
-		UIDialogShow(windowMain, 0, "Profile data could not be loaded (1).\nConsult the guide.\n%f%b", "OK");
-		return;
+		ProfFlameGraphIndexDepths(&level, maxDepth);
+		printf("Level of detail with %fms buckets has %d spans.\n", bucketWidth, level.times.Length());
+		report->levels.Add(level);
 	}
-	
-	int rawEntryCount = atoi(strstr(EvaluateExpression("gfProfilingBufferPosition"), "= ") + 2);
-	printf("Reading %d profiling entries...\n", rawEntryCount);
+}
 
-	if (rawEntryCount == 0) {
-		return;
-	}
+struct ProfStatisticsTask {
+	pthread_t thread;
+	ProfFlameGraphReport *report;
+	ProfFlameGraphEntryTime *times;
+	int start, end;
+	MapShort<void *, ProfFunctionEntry> functions;
+	int maxDepth;
+};
 
-	if (rawEntryCount > 10000000) {
-		// Show a loading message.
-		UIWindow *window = windowMain;
-		UIPainter painter = {};
-		painter.bits = window->bits;
-		painter.width = window->width;
-		painter.height = window->height;
-		painter.clip = UI_RECT_2S(window->width, window->height);
-		char string[256];
-		StringFormat(string, sizeof(string), "Loading data... (estimated time: %d seconds)", rawEntryCount / 5000000 + 1);
-		UIDrawBlock(&painter, painter.clip, ui.theme.panel1);
-		UIDrawString(&painter, painter.clip, string, -1, ui.theme.text, UI_ALIGN_CENTER, 0);
-		window->updateRegion = UI_RECT_2S(window->width, window->height);
-		_UIWindowEndPaint(window, nullptr);
-		window->updateRegion = painter.clip;
-	}
+#define PROF_STATISTICS_MINIMUM_ENTRIES (100000)
 
-	ProfProfilingEntry *rawEntries = (ProfProfilingEntry *) calloc(rawEntryCount, sizeof(ProfProfilingEntry));
+void *ProfStatisticsThread(void *_task) {
+	ProfStatisticsTask *task = (ProfStatisticsTask *) _task;
+	ProfFlameGraphEntry *entries = task->report->entries.array;
 
-	char path[PATH_MAX];
-	realpath(".profile.gf", path);
-	char buffer[PATH_MAX * 2];
-	StringFormat(buffer, sizeof(buffer), "dump binary memory %s (gfProfilingBuffer) (gfProfilingBuffer+gfProfilingBufferPosition)", path);
-	EvaluateCommand(buffer);
-	FILE *f = fopen(path, "rb");
+	for (int i = task->start; i < task->end; i++) {
+		ProfFlameGraphEntryTime *time = &task->times[i];
+		time->start = entries[i].startTime;
+		time->end = entries[i].endTime;
+		time->depth = entries[i].depth;
 
-	if (!f) {
-		UIDialogShow(windowMain, 0, "Profile data could not be loaded (2).\nConsult the guide.\n%f%b", "OK");
-		free(rawEntries);
-		return;
+		if (entries[i].depth > task->maxDepth) {
+			task->maxDepth = entries[i].depth;
+		}
+
+		if (!entries[i].thisFunction) continue; // The call started before the capture, and had not returned by the end.
+		ProfFunctionEntry *function = task->functions.At(entries[i].thisFunction, true);
+		function->callCount++;
+		function->totalTime += entries[i].endTime - entries[i].startTime;
 	}
 
-	fread(rawEntries, 1, sizeof(ProfProfilingEntry) * rawEntryCount, f);
-	fclose(f);
-	unlink(path);
+	return nullptr;
+}
 
-	printf("Got raw profile data.\n");
+int ProfProfilingChunkCompare(const void *_a, const void *_b) {
+	ProfProfilingChunk *a = *(ProfProfilingChunk **) _a;
+	ProfProfilingChunk *b = *(ProfProfilingChunk **) _b;
+	return a->timeStamp > b->timeStamp ? 1 : a->timeStamp < b->timeStamp ? -1 : a > b ? 1 : a < b ? -1 : 0;
+}
 
-	MapShort<void *, ProfFunctionEntry> functions = {};
-	Array<ProfSourceFileEntry> sourceFiles = {};
+ProfEventDecoder ProfEventDecoderStart(ProfProfilingChunk *chunk, void **functionTable, size_t functionCapacity) {
+	ProfEventDecoder decoder = {};
+	decoder.position = (const uint8_t *) (chunk + 1);
+	decoder.end = decoder.position + chunk->bytes;
+	decoder.timeStamp = chunk->timeStamp;
+	decoder.functionTable = functionTable;
+	decoder.functionCapacity = functionCapacity;
+	return decoder;
+}
 
-	int stackErrorCount = 0;
-	int stackDepth = 0;
+bool ProfEventDecoderReadVarint(ProfEventDecoder *decoder, uint64_t *value) {
+	*value = 0;
 
-	for (int i = 0; i < rawEntryCount; i++) {
-		if (rawEntries[i].timeStamp >> 63) {
-			if (stackDepth) stackDepth--;
-			else stackErrorCount++;
-		} else {
-			stackDepth++;
-		}
+	for (int shift = 0; decoder->position < decoder->end && shift < 64; shift += 7) {
+		uint8_t byte = *decoder->position++;
+		*value |= (uint64_t) (byte & 0x7F) << shift;
+		if (~byte & 0x80) return true;
+	}
+
+	return false;
+}
 
-		if (functions.Has(rawEntries[i].thisFunction)) continue;
-		ProfFunctionEntry *function = functions.At(rawEntries[i].thisFunction, true);
+bool ProfEventDecode(ProfEventDecoder *decoder, ProfProfilingEntry *entry) {
+	uint64_t function, delta;
 
-		function->sourceFileIndex = -1;
+	if (!ProfEventDecoderReadVarint(decoder, &function) || !ProfEventDecoderReadVarint(decoder, &delta)
+			|| (function >> 1) >= decoder->functionCapacity || !decoder->functionTable[function >> 1]) {
+		return false;
+	}
 
-		StringFormat(buffer, sizeof(buffer), "(void *) %ld", rawEntries[i].thisFunction);
-		const char *cName = EvaluateExpression(buffer);
-		if (!cName) continue;
+	decoder->timeStamp += delta;
+	decoder->functionIndex = function >> 1;
+	entry->thisFunction = decoder->functionTable[function >> 1];
+	entry->timeStamp = decoder->timeStamp | (function & 1) << 63;
+	return true;
+}
 
-		if (strchr(cName, '<')) cName = strchr(cName, '<') + 1;
-		int length = strlen(cName);
-		if (length > (int) sizeof(function->cName) - 1) length = sizeof(function->cName) - 1;
-		memcpy(function->cName, cName, length);
-		function->cName[length] = 0;
+void ProfSymbolCacheValidate() {
+	// Symbols are cached by address, so the cache is only valid while every loaded object file is unchanged and loaded at the same address.
+	// A new process, from restarting or attaching, may have loaded them elsewhere.
+	EvaluateCommand("py gf_build_id()");
+	uint64_t buildID = Hash((const uint8_t *) evaluateResult, strlen(evaluateResult));
 
-		int inTemplate = 0;
+	if (buildID != profSymbolBuildID) {
+		profSymbolCache.Free();
+		profSymbolBuildID = buildID;
+	}
+}
 
-		for (int j = 0; j < length; j++) {
-			if (function->cName[j] == '(' && !inTemplate) {
-				function->cName[j] = 0;
+void ProfSymbolParseName(ProfSymbol *symbol, const char *cName) {
+	if (strchr(cName, '<')) cName = strchr(cName, '<') + 1;
+	int length = strlen(cName);
+	if (length > (int) sizeof(symbol->cName) - 1) length = sizeof(symbol->cName) - 1;
+	memcpy(symbol->cName, cName, length);
+	symbol->cName[length] = 0;
+
+	int inTemplate = 0;
+
+	for (int j = 0; j < length; j++) {
+		if (symbol->cName[j] == '(' && !inTemplate) {
+			symbol->cName[j] = 0;
+			break;
+		} else if (symbol->cName[j] == '<') {
+			inTemplate++;
+		} else if (symbol->cName[j] == '>') {
+			if (inTemplate) {
+				inTemplate--;
+			} else {
+				symbol->cName[j] = 0;
 				break;
-			} else if (function->cName[j] == '<') {
-				inTemplate++;
-			} else if (function->cName[j] == '>') {
-				if (inTemplate) {
-					inTemplate--;
-				} else {
-					function->cName[j] = 0;
-					break;
-				}
 			}
 		}
+	}
+}
 
-		StringFormat(buffer, sizeof(buffer), "py print(gdb.lookup_global_symbol('%s').symtab.filename)", function->cName);
-		EvaluateCommand(buffer);
+void ProfSymbolize(MapShort<void *, ProfFunctionEntry> *functions) {
+	Array<void *> pending = {};
+
+	for (uintptr_t i = 0; i < functions->capacity; i++) {
+		if (functions->array[i].key && !profSymbolCache.Has(functions->array[i].key)) {
+			pending.Add(functions->array[i].key);
+		}
+	}
+
+	printf("Symbolizing %d functions (%d cached)...\n", pending.Length(), (int) (functions->used - pending.Length()));
+
+	// Send the addresses in batches, so that each round trip stays well within the evaluation timeout.
+	char command[PROF_SYMBOLIZE_BATCH * 24 + 64];
+
+	for (int i = 0; i < pending.Length(); i += PROF_SYMBOLIZE_BATCH) {
+		int position = StringFormat(command, sizeof(command), "py gf_symbolize([");
+
+		for (int j = i; j < pending.Length() && j < i + PROF_SYMBOLIZE_BATCH; j++) {
+			position += StringFormat(command + position, sizeof(command) - position, "%s%lu", j == i ? "" : ",", (uintptr_t) pending[j]);
+		}
+
+		StringFormat(command + position, sizeof(command) - position, "])");
+		EvaluateCommand(command);
 
-		if (!strstr(evaluateResult, "Traceback (most recent call last):")) {
-			char *end = strchr(evaluateResult, '\n');
+		for (char *line = evaluateResult; line && *line; ) {
+			char *end = strchr(line, '\n');
 			if (end) *end = 0;
-			ProfSourceFileEntry sourceFile = {};
-			char *cSourceFile = evaluateResult;
-			length = strlen(cSourceFile);
-			if (length > (int) sizeof(sourceFile.cPath) - 1) length = sizeof(sourceFile.cPath) - 1;
-			memcpy(sourceFile.cPath, cSourceFile, length);
-			sourceFile.cPath[length] = 0;
-			StringFormat(buffer, sizeof(buffer), "py print(gdb.lookup_global_symbol('%s').line)", function->cName);
-			EvaluateCommand(buffer);
-			function->lineNumber = atoi(evaluateResult);
-
-			for (int i = 0; i < sourceFiles.Length(); i++) {
-				if (0 == strcmp(sourceFiles[i].cPath, sourceFile.cPath)) {
-					function->sourceFileIndex = i;
-					break;
-				}
+			char *lineNumber = strchr(line, '\t');
+			char *path = lineNumber ? strchr(lineNumber + 1, '\t') : nullptr;
+			char *name = path ? strchr(path + 1, '\t') : nullptr;
+
+			if (name) {
+				ProfSymbol *symbol = profSymbolCache.At((void *) strtoul(line, nullptr, 10), true);
+				*symbol = {};
+				ProfSymbolParseName(symbol, name + 1);
+				symbol->lineNumber = atoi(lineNumber + 1);
+				int length = name - path - 1;
+				if (length > (int) sizeof(symbol->sourceFile.cPath) - 1) length = sizeof(symbol->sourceFile.cPath) - 1;
+				memcpy(symbol->sourceFile.cPath, path + 1, length);
+				symbol->sourceFile.cPath[length] = 0;
 			}
 
-			if (function->sourceFileIndex == -1) {
-				function->sourceFileIndex = sourceFiles.Length();
-				sourceFiles.Add(sourceFile);
-			}
+			line = end ? end + 1 : nullptr;
 		}
 	}
 
-	UIMDIChild *window = UIMDIChildCreate(&dataWindow->e, UI_MDI_CHILD_CLOSE_BUTTON, UI_RECT_2S(800, 600), "Flame graph", -1);
-	UIButton *switchViewButton = UIButtonCreate(&window->e, UI_BUTTON_SMALL | UI_ELEMENT_NON_CLIENT, "Table view", -1);
-	UITable *table = UITableCreate(&window->e, 0, "Name\tTime spent (ms)\tCall count\tAverage per call (ms)");
-	ProfFlameGraphReport *report = (ProfFlameGraphReport *) UIElementCreate(sizeof(ProfFlameGraphReport), 
-			&window->e, 0, ProfFlameGraphMessage, "flame graph");
-
-	report->vScroll = UIScrollBarCreate(&report->e, 0);
-	report->font = data->fontFlameGraph;
+	pending.Free();
+}
 
-	window->e.cp = report;
-	window->e.messageUser = ProfReportWindowMessage;
-	switchViewButton->e.cp = report;
-	switchViewButton->invoke = ProfSwitchView;
-	table->e.cp = report;
-	table->e.messageUser = ProfTableMessage;
-	report->switchViewButton = switchViewButton;
-	report->table = table;
+bool ProfCaptureAcquire(ProfCapture *capture) {
+	const char *ticksPerMsString = EvaluateExpression("gfProfilingTicksPerMs");
+	ticksPerMsString = ticksPerMsString ? strstr(ticksPerMsString, "= ") : nullptr;
+	capture->ticksPerMs = ticksPerMsString ? atoi(ticksPerMsString + 2) : 0;
 
-	report->functions = functions;
-	functions = {};
-	report->sourceFiles = sourceFiles;
-	sourceFiles = {};
+	if (!ticksPerMsString || !capture->ticksPerMs) {
+		UIDialogShow(windowMain, 0, "Profile data could not be loaded (1).\nConsult the guide.\n%f%b", "OK");
+		return false;
+	}
 
-	Array<ProfFlameGraphEntry> stack = {};
+	const char *chunkCountString = EvaluateExpression("gfProfilingChunkCount");
+	chunkCountString = chunkCountString ? strstr(chunkCountString, "= ") : nullptr;
+	int chunkCount = chunkCountString ? atoi(chunkCountString + 2) : 0;
+	const char *chunkCapacityString = EvaluateExpression("gfProfilingChunkCapacity");
+	chunkCapacityString = chunkCapacityString ? strstr(chunkCapacityString, "= ") : nullptr;
+	int chunkCapacity = chunkCapacityString ? atoi(chunkCapacityString + 2) : 0;
+	const char *chunkBytesString = EvaluateExpression("gfProfilingChunkBytes");
+	chunkBytesString = chunkBytesString ? strstr(chunkBytesString, "= ") : nullptr;
+	size_t chunkBytes = chunkBytesString ? atoi(chunkBytesString + 2) : 0;
+	if (chunkCount > chunkCapacity) chunkCount = chunkCapacity;
+	printf("Reading %d profiling chunks...\n", chunkCount);
+
+	if (chunkCount <= 0) {
+		return false;
+	}
 
-	for (int i = 0; i < stackErrorCount; i++) {
-		ProfFlameGraphEntry entry = {};
-		entry.cName = "[unknown]";
-		entry.startTime = 0;
-		entry.depth = stack.Length();
-		stack.Add(entry);
+	if (chunkBytes <= sizeof(ProfProfilingChunk)) {
+		UIDialogShow(windowMain, 0, "Profile data could not be loaded (1).\nConsult the guide.\n%f%b", "OK");
+		return false;
 	}
 
-	for (int i = 0; i < rawEntryCount; i++) {
-		if (rawEntries[i].timeStamp >> 63) {
-			if (!stack.Length()) {
-				continue;
-			}
+	char path[PATH_MAX];
+	realpath(".profile.gf", path);
+	char buffer[PATH_MAX * 2];
+	StringFormat(buffer, sizeof(buffer), "dump binary memory %s (char *) gfProfilingBuffer ((char *) gfProfilingBuffer + %lu)", path, chunkCount * chunkBytes);
+	EvaluateCommand(buffer);
 
-			ProfFlameGraphEntry entry = stack.Last();
-			entry.endTime = (double) ((rawEntries[i].timeStamp & 0x7FFFFFFFFFFFFFFFUL) 
-					- (rawEntries[0].timeStamp & 0x7FFFFFFFFFFFFFFFUL)) / data->ticksPerMs;
+	// Map the dump rather than reading it into a separate buffer; the events are decoded straight from the page cache.
+	capture->mapping = MapFile(path, &capture->mappingBytes, chunkCount * chunkBytes);
+	unlink(path);
 
-			if (0 == strcmp(entry.cName, "[unknown]")) {
-				ProfFunctionEntry *function = report->functions.At(rawEntries[i].thisFunction, false);
-				if (function) entry.cName = function->cName;
-			}
+	if (!capture->mapping) {
+		UIDialogShow(windowMain, 0, "Profile data could not be loaded (2).\nConsult the guide.\n%f%b", "OK");
+		return false;
+	}
 
-			entry.thisFunction = rawEntries[i].thisFunction;
-			stack.Pop();
-			report->entries.Add(entry);
-		} else {
-			ProfFlameGraphEntry entry = {};
-			ProfFunctionEntry *function = report->functions.At(rawEntries[i].thisFunction, false);
+	FILE *f = nullptr;
 
-			if (function) {
-				entry.cName = function->cName;
-				entry.colorIndex = function->sourceFileIndex % (sizeof(profEntryColorPalette) / sizeof(profEntryColorPalette[0]));
-			}
+	const char *functionCapacityString = EvaluateExpression("gfProfilingFunctionCapacity");
+	functionCapacityString = functionCapacityString ? strstr(functionCapacityString, "= ") : nullptr;
+	capture->functionCapacity = functionCapacityString ? atoi(functionCapacityString + 2) : 0;
+	capture->functionTable = (void **) calloc(capture->functionCapacity, sizeof(void *));
+	StringFormat(buffer, sizeof(buffer), "dump binary memory %s (char *) gfProfilingFunctions ((char *) gfProfilingFunctions + %lu)",
+			path, capture->functionCapacity * sizeof(void *));
+	EvaluateCommand(buffer);
+	f = fopen(path, "rb");
 
-			entry.startTime = (double) (rawEntries[i].timeStamp 
-					- (rawEntries[0].timeStamp & 0x7FFFFFFFFFFFFFFFUL)) / data->ticksPerMs;
-			entry.thisFunction = rawEntries[i].thisFunction;
-			entry.depth = stack.Length();
-			stack.Add(entry);
-		}
+	if (!f || !capture->functionCapacity) {
+		UIDialogShow(windowMain, 0, "Profile data could not be loaded (2).\nConsult the guide.\n%f%b", "OK");
+		if (f) fclose(f);
+		return false;
 	}
 
-	for (int i = 0; i < report->entries.Length(); i++) {
-		if (report->entries[i].endTime > report->totalTime) {
-			report->totalTime = report->entries[i].endTime;
-		}
-	}
+	fread(capture->functionTable, 1, capture->functionCapacity * sizeof(void *), f);
+	fclose(f);
+	unlink(path);
 
-	while (stack.Length()) {
-		ProfFlameGraphEntry entry = stack.Last();
-		entry.endTime = report->totalTime;
-		stack.Pop();
-		report->entries.Add(entry);
+	for (int i = 0; i < chunkCount; i++) {
+		// The mapping is read-only, so skip chunks that are being reused or were not finished, rather than fixing them up.
+		ProfProfilingChunk *chunk = (ProfProfilingChunk *) (capture->mapping + i * chunkBytes);
+		if (!chunk->bytes || chunk->bytes > chunkBytes - sizeof(ProfProfilingChunk)) continue;
+		capture->chunks.Add(chunk);
 	}
 
-	if (!report->totalTime) {
-		report->totalTime = 1;
-	}
+	capture->live = true;
+	printf("Got raw profile data.\n");
+	return true;
+}
 
-	stack.Free();
-	report->xEnd = report->totalTime;
-	qsort(report->entries.array, report->entries.Length(), sizeof(ProfFlameGraphEntry), ProfFlameGraphEntryCompare);
+bool ProfCaptureLoad(ProfCapture *capture, const char *path) {
+	capture->mapping = MapFile(path, &capture->mappingBytes, sizeof(ProfCaptureHeader));
+	if (!capture->mapping) return false;
 
-	int maxDepth = 0;
+	ProfCaptureHeader *header = (ProfCaptureHeader *) capture->mapping;
+	const char *position = capture->mapping + sizeof(ProfCaptureHeader);
+	const char *end = capture->mapping + capture->mappingBytes;
 
-	for (int i = 0; i < report->entries.Length(); i++) {
-		ProfFlameGraphEntryTime time;
-		time.start = report->entries[i].startTime;
-		time.end = report->entries[i].endTime;
-		time.depth = report->entries[i].depth;
-		report->entryTimes.Add(time);
+	if (memcmp(header->signature, PROF_CAPTURE_SIGNATURE, sizeof(header->signature)) || header->version != PROF_CAPTURE_VERSION
+			|| header->headerBytes != sizeof(ProfCaptureHeader) || !header->functionCapacity
+			|| header->functionCapacity > (size_t) (end - position) / sizeof(void *)
+			|| header->symbolCount > ((size_t) (end - position) - header->functionCapacity * sizeof(void *)) / sizeof(ProfCaptureSymbol)) {
+		return false;
+	}
 
-		if (report->entries[i].depth > maxDepth) {
-			maxDepth = report->entries[i].depth;
-		}
+	capture->ticksPerMs = header->ticksPerMs;
+	capture->functionCapacity = header->functionCapacity;
+	capture->functionTable = (void **) malloc(capture->functionCapacity * sizeof(void *));
+	memcpy(capture->functionTable, position, capture->functionCapacity * sizeof(void *));
+	position += capture->functionCapacity * sizeof(void *);
+
+	for (uint64_t i = 0; i < header->symbolCount; i++, position += sizeof(ProfCaptureSymbol)) {
+		ProfCaptureSymbol *symbol = (ProfCaptureSymbol *) position;
+		if (!symbol->address) continue;
+		ProfSymbol *copy = capture->symbols.At((void *) symbol->address, true);
+		*copy = symbol->symbol;
+		copy->cName[sizeof(copy->cName) - 1] = 0;
+		copy->sourceFile.cPath[sizeof(copy->sourceFile.cPath) - 1] = 0;
+	}
 
-		ProfFunctionEntry *function = report->functions.At(report->entries[i].thisFunction, true);
-		function->callCount++;
-		function->totalTime += report->entries[i].endTime - report->entries[i].startTime;
+	for (uint64_t i = 0; i < header->chunkCount; i++) {
+		ProfProfilingChunk *chunk = (ProfProfilingChunk *) position;
+		if ((size_t) (end - position) < sizeof(ProfProfilingChunk)) return false;
+		if (chunk->bytes > (size_t) (end - position) - sizeof(ProfProfilingChunk)) return false;
+		size_t padded = (sizeof(ProfProfilingChunk) + chunk->bytes + 7) & ~7;
+		if (padded > (size_t) (end - position)) return false;
+		capture->chunks.Add(chunk);
+		position += padded;
 	}
 
-	printf("Found %ld functions over %d source files.\n", report->functions.used, report->sourceFiles.Length());
+	return capture->ticksPerMs != 0;
+}
 
-	report->vScroll->maximum = (maxDepth + 2) * 30;
+bool ProfCaptureSave(ProfCapture *capture, const char *path) {
+	FILE *f = fopen(path, "wb");
+	if (!f) return false;
+
+	ProfCaptureHeader header = {};
+	memcpy(header.signature, PROF_CAPTURE_SIGNATURE, sizeof(header.signature));
+	header.version = PROF_CAPTURE_VERSION;
+	header.headerBytes = sizeof(ProfCaptureHeader);
+	header.ticksPerMs = capture->ticksPerMs;
+	header.functionCapacity = capture->functionCapacity;
+	header.symbolCount = capture->symbols.used;
+	header.chunkCount = capture->chunks.Length();
+	fwrite(&header, 1, sizeof(header), f);
+	fwrite(capture->functionTable, sizeof(void *), capture->functionCapacity, f);
+
+	for (uintptr_t i = 0; i < capture->symbols.capacity; i++) {
+		if (!capture->symbols.array[i].key) continue;
+		ProfCaptureSymbol symbol = {};
+		symbol.address = (uintptr_t) capture->symbols.array[i].key;
+		symbol.symbol = capture->symbols.array[i].value;
+		fwrite(&symbol, 1, sizeof(symbol), f);
+	}
 
-	for (uintptr_t i = 0; i < report->functions.capacity; i++) {
-		if (report->functions.array[i].key) {
-			report->sortedFunctions.Add(report->functions.array[i].value);
-		}
+	for (int i = 0; i < capture->chunks.Length(); i++) {
+		const uint8_t padding[8] = {};
+		size_t bytes = sizeof(ProfProfilingChunk) + capture->chunks[i]->bytes;
+		fwrite(capture->chunks[i], 1, bytes, f);
+		fwrite(padding, 1, ((bytes + 7) & ~7) - bytes, f);
 	}
 
-	{
-		// Create an image of the graph for the zoom bar.
+	bool success = !ferror(f);
+	if (fclose(f)) success = false;
+	return success;
+}
 
-		UIPainter painter = {};
-		painter.width = 1200;
+int ProfReportBuild(ProfFlameGraphReport *report, ProfCapture *capture) {
+	// Returns the maximum depth of the entries.
+
+	// Group the chunks by the thread that claimed them.
+	// Each thread claims its chunks in order, so they are already in chronological order.
+
+	Array<ProfProfilingThread> threads = {};
+	size_t rawBytes = 0;
+	uint64_t baseTimeStamp = UINT64_MAX;
+	void **functionTable = capture->functionTable;
+	size_t functionCapacity = capture->functionCapacity;
+
+	for (int i = 0; i < capture->chunks.Length(); i++) {
+		ProfProfilingChunk *chunk = capture->chunks[i];
+		rawBytes += chunk->bytes;
+		if (chunk->timeStamp < baseTimeStamp) baseTimeStamp = chunk->timeStamp;
+
+		ProfProfilingThread *thread = nullptr;
+
+		for (int j = 0; j < threads.Length(); j++) {
+			if (threads[j].threadID == chunk->threadID) {
+				thread = &threads[j];
+				break;
+			}
+		}
+
+		if (!thread) {
+			ProfProfilingThread newThread = {};
+			newThread.threadID = chunk->threadID;
+			threads.Add(newThread);
+			thread = &threads.Last();
+		}
+
+		thread->chunks.Add(chunk);
+	}
+
+	for (int i = 0; i < threads.Length(); i++) {
+		// In flight recorder mode, each thread reuses its chunks in a ring.
+		qsort(threads[i].chunks.array, threads[i].chunks.Length(), sizeof(ProfProfilingChunk *), ProfProfilingChunkCompare);
+	}
+
+	printf("Reading %ld bytes of profiling events over %d threads...\n", rawBytes, threads.Length());
+
+	if (rawBytes > 40000000) {
+		// Show a loading message.
+		UIWindow *window = windowMain;
+		UIPainter painter = {};
+		painter.bits = window->bits;
+		painter.width = window->width;
+		painter.height = window->height;
+		painter.clip = UI_RECT_2S(window->width, window->height);
+		char string[256];
+		StringFormat(string, sizeof(string), "Loading data... (estimated time: %d seconds)", (int) (rawBytes / 20000000 + 1));
+		UIDrawBlock(&painter, painter.clip, ui.theme.panel1);
+		UIDrawString(&painter, painter.clip, string, -1, ui.theme.text, UI_ALIGN_CENTER, 0);
+		window->updateRegion = UI_RECT_2S(window->width, window->height);
+		_UIWindowEndPaint(window, nullptr);
+		window->updateRegion = painter.clip;
+	}
+
+	// Find the functions in the capture, and count the entries at each depth,
+	// so that the entries can be written directly into their final position.
+
+	uint8_t *functionSeen = (uint8_t *) calloc(functionCapacity, 1);
+	Array<int> negativeDepthCounts = {};
+
+	for (int t = 0; t < threads.Length(); t++) {
+		ProfProfilingThread *thread = &threads[t];
+		int stackDepth = 0; // Relative to the start of the capture; negative after returning from calls that started before it.
+		int minimumDepth = 0;
+
+		for (int c = 0; c < thread->chunks.Length(); c++) {
+			ProfEventDecoder decoder = ProfEventDecoderStart(thread->chunks[c], functionTable, functionCapacity);
+			ProfProfilingEntry rawEntry;
+
+			while (ProfEventDecode(&decoder, &rawEntry)) {
+				functionSeen[decoder.functionIndex] = true;
+
+				if (rawEntry.timeStamp >> 63) {
+					stackDepth--;
+					if (stackDepth < minimumDepth) minimumDepth = stackDepth;
+				} else {
+					Array<int> *counts = stackDepth >= 0 ? &thread->depthCounts : &negativeDepthCounts;
+					int index = stackDepth >= 0 ? stackDepth : -stackDepth - 1;
+					while (counts->Length() <= index) counts->Add(0);
+					(*counts)[index]++;
+					stackDepth++;
+				}
+			}
+		}
+
+		// Calls that started before the capture are placed above the others as "[unknown]" entries.
+		thread->stackErrorCount = -minimumDepth;
+
+		for (int i = 0; i < thread->stackErrorCount; i++) {
+			int count = (i < negativeDepthCounts.Length() ? negativeDepthCounts[i] : 0) + 1;
+			thread->depthCounts.Insert(count, 0);
+		}
+
+		negativeDepthCounts.Free();
+	}
+
+	for (uintptr_t i = 0; i < functionCapacity; i++) {
+		if (!functionSeen[i]) continue;
+		ProfFunctionEntry *function = report->functions.At(functionTable[i], true);
+		function->sourceFileIndex = -1;
+	}
+
+	free(functionSeen);
+
+	if (capture->live) {
+		ProfSymbolCacheValidate();
+		ProfSymbolize(&report->functions);
+
+		// Keep a copy of the symbols with the capture, so that it can be saved.
+		for (uintptr_t i = 0; i < report->functions.capacity; i++) {
+			void *address = report->functions.array[i].key;
+			if (!address || !profSymbolCache.Has(address)) continue;
+			*capture->symbols.At(address, true) = *profSymbolCache.At(address, false);
+		}
+	}
+
+	for (uintptr_t i = 0; i < report->functions.capacity; i++) {
+		if (!report->functions.array[i].key || !capture->symbols.Has(report->functions.array[i].key)) continue;
+		ProfFunctionEntry *function = &report->functions.array[i].value;
+		ProfSymbol *symbol = capture->symbols.At(report->functions.array[i].key, false);
+
+		memcpy(function->cName, symbol->cName, sizeof(function->cName));
+		if (!symbol->sourceFile.cPath[0]) continue;
+		function->lineNumber = symbol->lineNumber;
+
+		for (int j = 0; j < report->sourceFiles.Length(); j++) {
+			if (0 == strcmp(report->sourceFiles[j].cPath, symbol->sourceFile.cPath)) {
+				function->sourceFileIndex = j;
+				break;
+			}
+		}
+
+		if (function->sourceFileIndex == -1) {
+			function->sourceFileIndex = report->sourceFiles.Length();
+			report->sourceFiles.Add(symbol->sourceFile);
+		}
+	}
+
+	// Give each thread its own lane of rows, on a timeline shared by all threads.
+	// Calls at the same depth never overlap, so they finish in order of their start times,
+	// and each can be written straight to the next free position in its row.
+
+	Array<int> rowPositions = {};
+	int entryCount = 0;
+
+	for (int t = 0; t < threads.Length(); t++) {
+		ProfThreadLane lane = {};
+		lane.threadID = threads[t].threadID;
+		lane.depth = rowPositions.Length();
+		report->lanes.Add(lane);
+		rowPositions.Add(entryCount);
+
+		for (int i = 0; i < threads[t].depthCounts.Length(); i++) {
+			rowPositions.Add(entryCount);
+			entryCount += threads[t].depthCounts[i];
+		}
+	}
+
+	report->entries.array = (ProfFlameGraphEntry *) malloc(entryCount * sizeof(ProfFlameGraphEntry));
+	report->entries.length = report->entries.allocated = entryCount;
+
+	// Look up functions by their index in the function table, rather than hashing their address for every event.
+	ProfFunctionEntry **functionEntries = (ProfFunctionEntry **) calloc(functionCapacity, sizeof(ProfFunctionEntry *));
+
+	for (uintptr_t i = 0; i < functionCapacity; i++) {
+		if (functionTable[i] && report->functions.Has(functionTable[i])) {
+			functionEntries[i] = report->functions.At(functionTable[i], false);
+		}
+	}
+
+	Array<ProfFlameGraphEntry> stack = {};
+	Array<ProfFlameGraphEntry> unfinished = {};
+	Array<double> childTimes = {}; // The time spent in the completed calls made by each call on the stack.
+	Array<double> unfinishedChildTimes = {};
+
+	for (int t = 0; t < threads.Length(); t++) {
+		int firstDepth = report->lanes[t].depth + 1;
+
+		for (int i = 0; i < threads[t].stackErrorCount; i++) {
+			ProfFlameGraphEntry entry = {};
+			entry.cName = "[unknown]";
+			entry.startTime = 0;
+			entry.depth = firstDepth + stack.Length();
+			stack.Add(entry);
+			childTimes.Add(0);
+		}
+
+		for (int c = 0; c < threads[t].chunks.Length(); c++) {
+			ProfEventDecoder decoder = ProfEventDecoderStart(threads[t].chunks[c], functionTable, functionCapacity);
+			ProfProfilingEntry rawEntry;
+
+			while (ProfEventDecode(&decoder, &rawEntry)) {
+				if (rawEntry.timeStamp >> 63) {
+					if (!stack.Length()) {
+						continue;
+					}
+
+					ProfFlameGraphEntry entry = stack.Last();
+					ProfFunctionEntry *function = functionEntries[decoder.functionIndex];
+					entry.endTime = (double) ((rawEntry.timeStamp & 0x7FFFFFFFFFFFFFFFUL) - baseTimeStamp) / capture->ticksPerMs;
+
+					if (!entry.thisFunction) {
+						// The call started before the capture.
+						if (function) entry.cName = function->cName;
+					}
+
+					if (entry.endTime > report->totalTime) {
+						report->totalTime = entry.endTime;
+					}
+
+					double duration = entry.endTime - entry.startTime;
+					if (function) function->selfTime += duration - childTimes.Last();
+					childTimes.Pop();
+					if (childTimes.Length()) childTimes.Last() += duration;
+
+					entry.thisFunction = rawEntry.thisFunction;
+					stack.Pop();
+					report->entries.array[rowPositions[entry.depth]++] = entry;
+				} else {
+					ProfFlameGraphEntry entry = {};
+					ProfFunctionEntry *function = functionEntries[decoder.functionIndex];
+
+					if (function) {
+						entry.cName = function->cName;
+						entry.colorIndex = function->sourceFileIndex % (sizeof(profEntryColorPalette) / sizeof(profEntryColorPalette[0]));
+					}
+
+					entry.startTime = (double) (rawEntry.timeStamp - baseTimeStamp) / capture->ticksPerMs;
+					entry.thisFunction = rawEntry.thisFunction;
+					entry.depth = firstDepth + stack.Length();
+					stack.Add(entry);
+					childTimes.Add(0);
+				}
+			}
+		}
+
+		unfinished.AddMany(stack.array, stack.Length());
+		unfinishedChildTimes.AddMany(childTimes.array, childTimes.Length());
+		stack.Free();
+		childTimes.Free();
+		threads[t].chunks.Free();
+		threads[t].depthCounts.Free();
+	}
+
+	threads.Free();
+	free(functionEntries);
+
+	for (int i = 0; i < unfinished.Length(); i++) {
+		// Each of these is the last call at its depth.
+		ProfFlameGraphEntry entry = unfinished[i];
+		entry.endTime = report->totalTime;
+		report->entries.array[rowPositions[entry.depth]++] = entry;
+
+		if (entry.thisFunction) {
+			// The next unfinished call in the same lane is still running in this one.
+			bool hasChild = i + 1 < unfinished.Length() && unfinished[i + 1].depth == entry.depth + 1;
+			double childTime = unfinishedChildTimes[i] + (hasChild ? entry.endTime - unfinished[i + 1].startTime : 0);
+			report->functions.At(entry.thisFunction, false)->selfTime += entry.endTime - entry.startTime - childTime;
+		}
+	}
+
+	unfinished.Free();
+	unfinishedChildTimes.Free();
+	rowPositions.Free();
+
+	if (!report->totalTime) {
+		report->totalTime = 1;
+	}
+
+	report->xEnd = report->totalTime;
+
+	// Compute the function statistics in parallel.
+
+	int maxDepth = 0;
+	ProfFlameGraphLevel firstLevel = {};
+	firstLevel.times.array = (ProfFlameGraphEntryTime *) malloc(report->entries.Length() * sizeof(ProfFlameGraphEntryTime));
+	firstLevel.times.length = firstLevel.times.allocated = report->entries.Length();
+
+	int taskCount = sysconf(_SC_NPROCESSORS_ONLN);
+	if (taskCount > report->entries.Length() / PROF_STATISTICS_MINIMUM_ENTRIES) taskCount = report->entries.Length() / PROF_STATISTICS_MINIMUM_ENTRIES;
+	if (taskCount < 1) taskCount = 1;
+	ProfStatisticsTask *tasks = (ProfStatisticsTask *) calloc(taskCount, sizeof(ProfStatisticsTask));
+
+	for (int i = 0; i < taskCount; i++) {
+		tasks[i].report = report;
+		tasks[i].times = firstLevel.times.array;
+		tasks[i].start = (uint64_t) report->entries.Length() * i / taskCount;
+		tasks[i].end = (uint64_t) report->entries.Length() * (i + 1) / taskCount;
+		if (i) pthread_create(&tasks[i].thread, nullptr, ProfStatisticsThread, &tasks[i]);
+	}
+
+	ProfStatisticsThread(&tasks[0]);
+
+	for (int i = 0; i < taskCount; i++) {
+		if (i) pthread_join(tasks[i].thread, nullptr);
+		if (tasks[i].maxDepth > maxDepth) maxDepth = tasks[i].maxDepth;
+
+		for (uintptr_t j = 0; j < tasks[i].functions.capacity; j++) {
+			if (!tasks[i].functions.array[j].key) continue;
+			ProfFunctionEntry *function = report->functions.At(tasks[i].functions.array[j].key, true);
+			function->callCount += tasks[i].functions.array[j].value.callCount;
+			function->totalTime += tasks[i].functions.array[j].value.totalTime;
+		}
+
+		tasks[i].functions.Free();
+	}
+
+	free(tasks);
+
+	report->levels.Add(firstLevel);
+	printf("Found %ld functions over %d source files.\n", report->functions.used, report->sourceFiles.Length());
+	return maxDepth;
+}
+
+void ProfReportUpdateFunctionTable(ProfFlameGraphReport *report) {
+	report->sortedFunctions.Free();
+
+	for (uintptr_t i = 0; i < report->functions.capacity; i++) {
+		if (report->functions.array[i].key) {
+			report->sortedFunctions.Add(report->functions.array[i].value);
+		}
+	}
+
+	UI_FREE(report->table->columns);
+	report->table->columns = UIStringCopy(report->hasBaseline
+			? "Name\tTime spent (ms)\tSelf time (ms)\tCall count\tAverage per call (ms)\tChange in time (ms)\tChange in self time (ms)"
+			: "Name\tTime spent (ms)\tSelf time (ms)\tCall count\tAverage per call (ms)", -1);
+	report->table->itemCount = report->sortedFunctions.Length();
+	qsort(report->sortedFunctions.array, report->sortedFunctions.Length(), sizeof(ProfFunctionEntry), ProfFunctionCompareTotalTime);
+	report->table->columnHighlight = 1;
+	UITableResizeColumns(report->table);
+}
+
+void ProfSaveCapture(void *_report) {
+	ProfFlameGraphReport *report = (ProfFlameGraphReport *) _report;
+	static char *path = NULL;
+	const char *result = UIDialogShow(windowMain, 0, "Save capture       \nPath:\n%t\n%f%b%b", &path, "Save", "Cancel");
+	if (strcmp(result, "Save")) return;
+
+	if (!ProfCaptureSave(&report->capture, path)) {
+		UIDialogShow(windowMain, 0, "The capture could not be saved.\n%f%b", "OK");
+	}
+}
+
+uint64_t ProfFunctionHash(ProfFunctionEntry *function, ProfFlameGraphReport *report) {
+	// Functions are matched between captures by their name and source file, since the program may have been rebuilt in between.
+	char buffer[sizeof(function->cName) + sizeof(ProfSourceFileEntry) + 2];
+	int length = StringFormat(buffer, sizeof(buffer), "%s\t%s", function->cName,
+			function->sourceFileIndex != -1 ? report->sourceFiles[function->sourceFileIndex].cPath : "");
+	uint64_t hash = Hash((const uint8_t *) buffer, length);
+	return hash ? hash : 1;
+}
+
+uint8_t ProfChangeColorIndex(double time, double baselineTime, bool inBaseline) {
+	const int middle = sizeof(profChangeColorPalette) / sizeof(profChangeColorPalette[0]) / 2;
+	double largest = time > baselineTime ? time : baselineTime;
+	double change = !inBaseline ? 1 : largest > 0 ? (time - baselineTime) / largest : 0;
+	return middle + (int) (change * middle + (change > 0 ? 0.5 : -0.5));
+}
+
+void ProfCompareWithCapture(void *_report) {
+	ProfFlameGraphReport *report = (ProfFlameGraphReport *) _report;
+	static char *path = NULL;
+	const char *result = UIDialogShow(windowMain, 0, "Compare with saved capture\nPath:\n%t\n%f%b%b", &path, "Compare", "Cancel");
+	if (strcmp(result, "Compare")) return;
+
+	ProfFlameGraphReport *baseline = (ProfFlameGraphReport *) calloc(1, sizeof(ProfFlameGraphReport));
+
+	if (!ProfCaptureLoad(&baseline->capture, path)) {
+		UIDialogShow(windowMain, 0, "The capture could not be loaded.\n%f%b", "OK");
+		ProfReportFree(baseline);
+		free(baseline);
+		return;
+	}
+
+	ProfReportBuild(baseline, &baseline->capture);
+	MapShort<uint64_t, ProfFunctionEntry> baselineFunctions = {};
+
+	for (uintptr_t i = 0; i < baseline->functions.capacity; i++) {
+		if (!baseline->functions.array[i].key) continue;
+		ProfFunctionEntry *function = &baseline->functions.array[i].value;
+		ProfFunctionEntry *total = baselineFunctions.At(ProfFunctionHash(function, baseline), true);
+		total->totalTime += function->totalTime;
+		total->selfTime += function->selfTime;
+	}
+
+	ProfReportFree(baseline);
+	free(baseline);
+
+	for (uintptr_t i = 0; i < report->functions.capacity; i++) {
+		if (!report->functions.array[i].key) continue;
+		ProfFunctionEntry *function = &report->functions.array[i].value;
+		uint64_t hash = ProfFunctionHash(function, report);
+		function->inBaseline = baselineFunctions.Has(hash);
+		function->baselineTotalTime = function->inBaseline ? baselineFunctions.At(hash, false)->totalTime : 0;
+		function->baselineSelfTime = function->inBaseline ? baselineFunctions.At(hash, false)->selfTime : 0;
+	}
+
+	baselineFunctions.Free();
+
+	for (int i = 0; i < report->entries.Length(); i++) {
+		ProfFlameGraphEntry *entry = &report->entries[i];
+		if (!entry->thisFunction) continue;
+		ProfFunctionEntry *function = report->functions.At(entry->thisFunction, false);
+		entry->changeColorIndex[0] = ProfChangeColorIndex(function->totalTime, function->baselineTotalTime, function->inBaseline);
+		entry->changeColorIndex[1] = ProfChangeColorIndex(function->selfTime, function->baselineSelfTime, function->inBaseline);
+	}
+
+	for (int i = 0; i < report->entries.Length(); i++) {
+		if (!report->entries[i].thisFunction) {
+			// Calls that started before the capture and had not returned are not counted.
+			report->entries[i].changeColorIndex[0] = report->entries[i].changeColorIndex[1] = sizeof(profChangeColorPalette) / sizeof(profChangeColorPalette[0]) / 2;
+		}
+	}
+
+	report->hasBaseline = true;
+	if (report->colorMode == PROF_COLOR_SOURCE_FILE) ProfSwitchColorMode(report);
+	ProfReportUpdateFunctionTable(report);
+	UIElementRefresh(report->e.parent);
+}
+
+struct ProfFoldedNode {
+	uint32_t parent; // 0 for the node of each lane.
+	const char *cName;
+	uint64_t threadID;
+	double time, childTime;
+};
+
+void ProfExportString(FILE *f, const char *string) {
+	// Escape a string for a JSON document.
+	fputc('"', f);
+
+	for (; *string; string++) {
+		if (*string == '"' || *string == '\\') fprintf(f, "\\%c", *string);
+		else if ((uint8_t) *string < 0x20) fprintf(f, "\\u%04x", *string);
+		else fputc(*string, f);
+	}
+
+	fputc('"', f);
+}
+
+void ProfExportLaneRows(ProfFlameGraphReport *report, int lane, int *firstRow, int *endRow) {
+	*firstRow = report->lanes[lane].depth + 1;
+	*endRow = lane + 1 < report->lanes.Length() ? report->lanes[lane + 1].depth : report->levels[0].depthStart.Length() - 1;
+	if (*endRow < *firstRow) *endRow = *firstRow;
+}
+
+void ProfExportChromeTrace(ProfFlameGraphReport *report, FILE *f) {
+	// Written as the trace event format's "complete" events, with one thread for each lane.
+	ProfFlameGraphLevel *level = &report->levels[0];
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	for (int i = 0; i < report->lanes.Length(); i++) {
+		uint64_t threadID = report->lanes[i].threadID;
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%lu,\"args\":{\"name\":\"Thread %lu\"}}",
+				i ? ",\n" : "", threadID, threadID);
+
+		int firstRow, endRow;
+		ProfExportLaneRows(report, i, &firstRow, &endRow);
+
+		for (int j = level->depthStart[firstRow]; j < level->depthStart[endRow]; j++) {
+			ProfFlameGraphEntry *entry = &report->entries[j];
+			fprintf(f, ",\n{\"name\":");
+			ProfExportString(f, entry->cName ? entry->cName : "??");
+			fprintf(f, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%lu}",
+					entry->startTime * 1000.0, (entry->endTime - entry->startTime) * 1000.0, threadID);
+		}
+	}
+
+	fprintf(f, "\n]}\n");
+}
+
+void ProfExportFoldedStacks(ProfFlameGraphReport *report, FILE *f) {
+	// Each line is a call stack, from the lane down to the function, followed by the self time spent there in microseconds.
+	// Calls with the same stack are merged into one node of a call tree.
+	ProfFlameGraphLevel *level = &report->levels[0];
+	Array<ProfFoldedNode> nodes = {};
+	MapShort<uint64_t, uint32_t> children = {};
+	Array<uint32_t> previousRowNodes = {}, rowNodes = {};
+	nodes.Add({}); // Unused, so that node 0 can mean no parent.
+
+	for (int i = 0; i < report->lanes.Length(); i++) {
+		ProfFoldedNode root = {};
+		root.threadID = report->lanes[i].threadID;
+		uint32_t rootIndex = nodes.Length();
+		nodes.Add(root);
+
+		int firstRow, endRow;
+		ProfExportLaneRows(report, i, &firstRow, &endRow);
+		previousRowNodes.Free();
+
+		for (int depth = firstRow; depth < endRow; depth++) {
+			// Calls at the same depth are sorted by time, so the caller of each call is found by walking the row above alongside.
+			int parentIndex = depth > firstRow ? level->depthStart[depth - 1] : 0;
+			int parentEnd = depth > firstRow ? level->depthStart[depth] : 0;
+
+			for (int j = level->depthStart[depth]; j < level->depthStart[depth + 1]; j++) {
+				ProfFlameGraphEntry *entry = &report->entries[j];
+				while (parentIndex < parentEnd && report->entries[parentIndex].endTime < entry->endTime) parentIndex++;
+				bool hasParent = parentIndex < parentEnd && report->entries[parentIndex].startTime <= entry->startTime;
+				uint32_t parent = hasParent ? previousRowNodes[parentIndex - level->depthStart[depth - 1]] : rootIndex;
+
+				// Functions are identified by the position of their entry in the function map.
+				uintptr_t function = entry->thisFunction ? ((char *) report->functions.At(entry->thisFunction, false) 
+						- (char *) report->functions.array) / sizeof(report->functions.array[0]) + 1 : 0;
+				uint64_t key = ((uint64_t) parent << 32) | function;
+				uint32_t node;
+
+				if (children.Has(key)) {
+					node = *children.At(key, false);
+				} else {
+					ProfFoldedNode newNode = {};
+					newNode.parent = parent;
+					newNode.cName = entry->cName ? entry->cName : "??";
+					node = nodes.Length();
+					nodes.Add(newNode);
+					*children.At(key, true) = node;
+				}
+
+				double duration = entry->endTime - entry->startTime;
+				nodes[node].time += duration;
+				nodes[parent].childTime += duration;
+				rowNodes.Add(node);
+			}
+
+			previousRowNodes.Free();
+			previousRowNodes = rowNodes;
+			rowNodes = {};
+		}
+	}
+
+	Array<uint32_t> path = {};
+
+	for (int i = 1; i < nodes.Length(); i++) {
+		int64_t selfTime = (int64_t) ((nodes[i].time - nodes[i].childTime) * 1000.0 + 0.5);
+		if (selfTime <= 0) continue;
+
+		for (uint32_t node = i; node; node = nodes[node].parent) {
+			path.Add(node);
+		}
+
+		fprintf(f, "Thread %lu", nodes[path.Last()].threadID);
+
+		for (int j = path.Length() - 2; j >= 0; j--) {
+			fprintf(f, ";%s", nodes[path[j]].cName);
+		}
+
+		fprintf(f, " %ld\n", selfTime);
+		path.length = 0;
+	}
+
+	path.Free();
+	previousRowNodes.Free();
+	nodes.Free();
+	children.Free();
+}
+
+void ProfExport(void *_report) {
+	ProfFlameGraphReport *report = (ProfFlameGraphReport *) _report;
+	static char *path = NULL;
+	const char *result = UIDialogShow(windowMain, 0, "Export capture     \nPath:\n%t\n%f%b%b%b", &path, "Chrome trace", "Folded stacks", "Cancel");
+	if (0 == strcmp(result, "Cancel")) return;
+
+	FILE *f = fopen(path, "wb");
+	if (!f) { UIDialogShow(windowMain, 0, "Unable to open file for writing.\n%f%b", "OK"); return; }
+	setvbuf(f, nullptr, _IOFBF, 1 << 20);
+
+	if (0 == strcmp(result, "Chrome trace")) {
+		ProfExportChromeTrace(report, f);
+	} else {
+		ProfExportFoldedStacks(report, f);
+	}
+
+	bool success = !ferror(f);
+	if (fclose(f)) success = false;
+
+	if (!success) {
+		UIDialogShow(windowMain, 0, "The capture could not be exported.\n%f%b", "OK");
+	}
+}
+
+ProfFlameGraphReport *ProfReportCreate(ProfWindow *data, ProfCapture *capture, const char *title) {
+	UIMDIChild *window = UIMDIChildCreate(&dataWindow->e, UI_MDI_CHILD_CLOSE_BUTTON, UI_RECT_2S(800, 600), title, -1);
+	UIButton *switchViewButton = UIButtonCreate(&window->e, UI_BUTTON_SMALL | UI_ELEMENT_NON_CLIENT, "Table view", -1);
+	UIButton *colorModeButton = UIButtonCreate(&window->e, UI_BUTTON_SMALL | UI_ELEMENT_NON_CLIENT, "Color by source file", -1);
+	UIButton *compareButton = UIButtonCreate(&window->e, UI_BUTTON_SMALL | UI_ELEMENT_NON_CLIENT, "Compare", -1);
+	UIButton *saveButton = UIButtonCreate(&window->e, UI_BUTTON_SMALL | UI_ELEMENT_NON_CLIENT, "Save", -1);
+	UIButton *exportButton = UIButtonCreate(&window->e, UI_BUTTON_SMALL | UI_ELEMENT_NON_CLIENT, "Export", -1);
+	UITable *table = UITableCreate(&window->e, 0, "");
+	ProfFlameGraphReport *report = (ProfFlameGraphReport *) UIElementCreate(sizeof(ProfFlameGraphReport),
+			&window->e, 0, ProfFlameGraphMessage, "flame graph");
+
+	report->vScroll = UIScrollBarCreate(&report->e, 0);
+	report->font = data->fontFlameGraph;
+
+	window->e.cp = report;
+	window->e.messageUser = ProfReportWindowMessage;
+	switchViewButton->e.cp = report;
+	switchViewButton->invoke = ProfSwitchView;
+	colorModeButton->e.cp = report;
+	colorModeButton->invoke = ProfSwitchColorMode;
+	compareButton->e.cp = report;
+	compareButton->invoke = ProfCompareWithCapture;
+	saveButton->e.cp = report;
+	saveButton->invoke = ProfSaveCapture;
+	exportButton->e.cp = report;
+	exportButton->invoke = ProfExport;
+	table->e.cp = report;
+	table->e.messageUser = ProfTableMessage;
+	report->switchViewButton = switchViewButton;
+	report->colorModeButton = colorModeButton;
+	report->table = table;
+
+	// The report keeps the raw events, so that they can be saved later.
+	report->capture = *capture;
+	*capture = {};
+
+	int maxDepth = ProfReportBuild(report, &report->capture);
+	ProfFlameGraphBuildLevels(report, maxDepth);
+
+	report->vScroll->maximum = (maxDepth + 2) * 30;
+
+	{
+		// Create an image of the graph for the zoom bar.
+
+		UIPainter painter = {};
+		painter.width = 1200;
 		painter.height = maxDepth * 30 + 30;
 		painter.clip = UI_RECT_4(0, painter.width, 0, painter.height);
 		painter.bits = (uint32_t *) malloc(painter.width * painter.height * 4);
@@ -973,12 +1994,229 @@ void ProfLoadProfileData(void *_window) {
 		report->thumbnailHeight = painter.height;
 	}
 
-	table->itemCount = report->sortedFunctions.Length();
-	qsort(report->sortedFunctions.array, report->sortedFunctions.Length(), sizeof(ProfFunctionEntry), ProfFunctionCompareTotalTime);
-	table->columnHighlight = 1;
-	UITableResizeColumns(table);
+	ProfReportUpdateFunctionTable(report);
+	return report;
+}
+
+void ProfLoadProfileData(void *_window) {
+	ProfCapture capture = {};
+
+	if (ProfCaptureAcquire(&capture)) {
+		ProfReportCreate((ProfWindow *) _window, &capture, "Flame graph");
+	}
+
+	ProfCaptureFree(&capture);
+}
+
+void ProfOpenCapture(void *_window) {
+	static char *path = NULL;
+	const char *result = UIDialogShow(windowMain, 0, "Open capture       \nPath:\n%t\n%f%b%b", &path, "Open", "Cancel");
+	if (strcmp(result, "Open")) return;
+
+	ProfCapture capture = {};
+
+	if (ProfCaptureLoad(&capture, path)) {
+		char title[256];
+		StringFormat(title, sizeof(title), "Flame graph - %s", path);
+		ProfReportCreate((ProfWindow *) _window, &capture, title);
+		InterfaceWindowSwitchToAndFocus("Data");
+		UIElementRefresh(&dataWindow->e);
+	} else {
+		UIDialogShow(windowMain, 0, "The capture could not be loaded.\n%f%b", "OK");
+	}
+
+	ProfCaptureFree(&capture);
+}
+
+void ProfSampleWriteVarint(Array<uint8_t> *events, uint64_t value) {
+	do {
+		uint8_t byte = value & 0x7F;
+		value >>= 7;
+		events->Add(value ? (byte | 0x80) : byte);
+	} while (value);
+}
+
+void ProfSampleWriteEvent(ProfSampledThread *thread, void *function, bool exit) {
+	// Samples are written in the same encoding as gf_profiling.c, so the capture can be shown, saved and compared like any other.
+	uint64_t timeStamp = (uint64_t) profSampler.sampleCount * PROF_SAMPLE_INTERVAL_MS * 1000;
+
+	if (!profSampler.functionIndices.Has(function)) {
+		*profSampler.functionIndices.At(function, true) = profSampler.functions.Length();
+		profSampler.functions.Add(function);
+	}
+
+	ProfSampleWriteVarint(&thread->events, (uint64_t) *profSampler.functionIndices.At(function, false) << 1 | exit);
+	ProfSampleWriteVarint(&thread->events, timeStamp - thread->lastTimeStamp);
+	thread->lastTimeStamp = timeStamp;
+}
+
+void ProfSampleUnwind(ProfSampledThread *thread, int depth) {
+	while (thread->stack.Length() > depth) {
+		ProfSampleWriteEvent(thread, thread->stack.Last(), true);
+		thread->stack.Pop();
+	}
+}
+
+void ProfSampleFinish() {
+	for (int i = 0; i < profSampler.threads.Length(); i++) {
+		// Threads that have exited return from all their calls.
+		if (!profSampler.threads[i].seen) ProfSampleUnwind(&profSampler.threads[i], 0);
+		profSampler.threads[i].seen = false;
+	}
+
+	profSampler.sampleCount++;
+	profSampler.inSample = false;
+}
+
+void ProfSamplerBuildCapture(ProfCapture *capture) {
+	capture->ticksPerMs = 1000;
+	capture->live = true;
+	size_t bytes = 0;
+
+	for (int i = 0; i < profSampler.threads.Length(); i++) {
+		ProfSampleUnwind(&profSampler.threads[i], 0);
+		bytes += (sizeof(ProfProfilingChunk) + profSampler.threads[i].events.Length() + 7) & ~7;
+	}
+
+	capture->memory = (uint8_t *) calloc(1, bytes);
+	uint8_t *position = capture->memory;
+
+	for (int i = 0; i < profSampler.threads.Length(); i++) {
+		ProfSampledThread *thread = &profSampler.threads[i];
+		ProfProfilingChunk *chunk = (ProfProfilingChunk *) position;
+		chunk->threadID = thread->threadID;
+		chunk->bytes = thread->events.Length();
+		memcpy(chunk + 1, thread->events.array, thread->events.Length());
+		if (chunk->bytes) capture->chunks.Add(chunk);
+		position += (sizeof(ProfProfilingChunk) + chunk->bytes + 7) & ~7;
+		thread->stack.Free();
+		thread->events.Free();
+	}
+
+	capture->functionCapacity = profSampler.functions.Length();
+	capture->functionTable = (void **) malloc(capture->functionCapacity * sizeof(void *));
+	memcpy(capture->functionTable, profSampler.functions.array, capture->functionCapacity * sizeof(void *));
+	printf("Collected %d samples of %d threads.\n", profSampler.sampleCount, profSampler.threads.Length());
+
+	profSampler.threads.Free();
+	profSampler.functions.Free();
+	profSampler.functionIndices.Free();
+}
+
+void ProfSamplerStop(bool resume) {
+	profSampler.active = false;
+	UI_FREE(profSampler.window->sampleButton->label);
+	profSampler.window->sampleButton->label = UIStringCopy("Start sampling", (profSampler.window->sampleButton->labelBytes = -1));
+	UIElementRefresh(&profSampler.window->sampleButton->e);
+
+	int sampleCount = profSampler.sampleCount;
+	ProfCapture capture = {};
+	ProfSamplerBuildCapture(&capture);
+
+	if (capture.chunks.Length()) {
+		char title[64];
+		StringFormat(title, sizeof(title), "Samples (%d every %dms)", sampleCount, PROF_SAMPLE_INTERVAL_MS);
+		ProfReportCreate(profSampler.window, &capture, title);
+		InterfaceWindowSwitchToAndFocus("Data");
+		UIElementRefresh(&dataWindow->e);
+	} else {
+		UIDialogShow(windowMain, 0, "No samples were collected.\nThe target must be running.\n%f%b", "OK");
+	}
+
+	ProfCaptureFree(&capture);
+
+	// Either let the target carry on running, or show where it stopped.
+	DebuggerSend(resume ? "c" : "frame", true, false);
+}
+
+bool ProfSampleParse(char *output) {
+	// Returns true if the target stopped for another reason, or exited.
+	bool stopped = false;
+
+	for (char *line = output; line && *line; ) {
+		char *end = strchr(line, '\n');
+		if (end) *end = 0;
+		char *common = strchr(line, '\t');
+		char *addresses = common ? strchr(common + 1, '\t') : nullptr;
+
+		if (0 == strcmp(line, "stopped")) {
+			stopped = true;
+		} else if (0 == strcmp(line, "sample")) {
+			if (profSampler.inSample) ProfSampleFinish();
+			profSampler.inSample = true;
+		} else if (addresses && profSampler.inSample) {
+			uint64_t threadID = strtoul(line, nullptr, 10);
+			ProfSampledThread *thread = nullptr;
+
+			for (int i = 0; i < profSampler.threads.Length(); i++) {
+				if (profSampler.threads[i].threadID == threadID) {
+					thread = &profSampler.threads[i];
+					break;
+				}
+			}
+
+			if (!thread) {
+				ProfSampledThread newThread = {};
+				newThread.threadID = threadID;
+				profSampler.threads.Add(newThread);
+				thread = &profSampler.threads.Last();
+			}
+
+			// Each sample accounts for the interval after it, so the calls that have changed since the previous sample end here.
+			ProfSampleUnwind(thread, atoi(common + 1));
+
+			for (char *address = addresses + 1; *address; ) {
+				void *function = (void *) strtoul(address, &address, 10);
+				ProfSampleWriteEvent(thread, function, false);
+				thread->stack.Add(function);
+				if (*address == ',') address++;
+				else break;
+			}
+
+			thread->seen = true;
+		}
+
+		line = end ? end + 1 : nullptr;
+	}
+
+	if (profSampler.inSample) {
+		ProfSampleFinish();
+	}
+
+	return stopped;
+}
+
+void ProfSampleBatch(char *) {
+	if (!profSampler.active) return;
+
+	char buffer[64];
+	StringFormat(buffer, sizeof(buffer), "py gf_sample(%d, %d)", PROF_SAMPLE_INTERVAL_MS, PROF_SAMPLE_BATCH_MS);
+	EvaluateCommand(buffer);
 
-	free(rawEntries);
+	if (ProfSampleParse(evaluateResult)) {
+		ProfSamplerStop(false);
+	} else {
+		// Let the interface handle input between batches, so that sampling can be stopped.
+		UIWindowPostMessage(windowMain, msgProfSample, nullptr);
+	}
+}
+
+void ProfToggleSampling(void *_window) {
+	ProfWindow *window = (ProfWindow *) _window;
+
+	if (profSampler.active) {
+		ProfSamplerStop(true);
+		return;
+	}
+
+	profSampler = {};
+	profSampler.active = true;
+	profSampler.window = window;
+	UI_FREE(window->sampleButton->label);
+	window->sampleButton->label = UIStringCopy("Stop sampling", (window->sampleButton->labelBytes = -1));
+	UIElementRefresh(&window->sampleButton->e);
+	EvaluateCommand("py gf_sample_start()");
+	ProfSampleBatch(nullptr);
 }
 
 void ProfStepOverProfiled(void *_window) {
@@ -988,15 +2226,36 @@ void ProfStepOverProfiled(void *_window) {
 	window->inStepOverProfiled = true;
 }
 
+void ProfShowRecentHistory(void *_window) {
+	ProfLoadProfileData(_window);
+	InterfaceWindowSwitchToAndFocus("Data");
+	UIElementRefresh(&dataWindow->e);
+}
+
+bool ProfIsStopReport(const char *data) {
+	if (strstr(data, "received signal")) return true;
+
+	// Look for "Breakpoint <number>, ", which is only printed when a breakpoint is hit.
+	for (const char *position = strstr(data, "Breakpoint "); position; position = strstr(position + 1, "Breakpoint ")) {
+		const char *end = position + 11;
+		while (isdigit(*end)) end++;
+		if (end != position + 11 && *end == ',') return true;
+	}
+
+	return false;
+}
+
 void ProfWindowUpdate(const char *data, UIElement *element) {
 	ProfWindow *window = (ProfWindow *) element->cp;
 
 	if (window->inStepOverProfiled) {
 		EvaluateCommand("call GfProfilingStop()");
-		ProfLoadProfileData(window);
-		InterfaceWindowSwitchToAndFocus("Data");
-		UIElementRefresh(&dataWindow->e);
+		ProfShowRecentHistory(window);
 		window->inStepOverProfiled = false;
+	} else if (window->loadHistoryOnStop->check == UI_CHECK_CHECKED && ProfIsStopReport(data)) {
+		const char *flightRecorder = EvaluateExpression("gfProfilingFlightRecorder");
+		flightRecorder = flightRecorder ? strstr(flightRecorder, "= ") : nullptr;
+		if (flightRecorder && atoi(flightRecorder + 2)) ProfShowRecentHistory(window);
 	}
 }
 
@@ -1009,6 +2268,16 @@ UIElement *ProfWindowCreate(UIElement *parent) {
 	UIButton *button = UIButtonCreate(&panel->e, UI_ELEMENT_V_FILL, "Step over profiled", -1);
 	button->e.cp = window;
 	button->invoke = ProfStepOverProfiled;
+	button = UIButtonCreate(&panel->e, UI_ELEMENT_V_FILL, "Show recent history", -1);
+	button->e.cp = window;
+	button->invoke = ProfShowRecentHistory;
+	button = UIButtonCreate(&panel->e, UI_ELEMENT_V_FILL, "Open capture", -1);
+	button->e.cp = window;
+	button->invoke = ProfOpenCapture;
+	window->sampleButton = UIButtonCreate(&panel->e, UI_ELEMENT_V_FILL, "Start sampling", -1);
+	window->sampleButton->e.cp = window;
+	window->sampleButton->invoke = ProfToggleSampling;
+	window->loadHistoryOnStop = UICheckboxCreate(&panel->e, 0, "Show history when stopped", -1);
 
 #ifdef UI_FREETYPE
 	// Since we will do multithreaded painting with fontFlameGraph, we need to make sure all its glyphs are ready to go.
@@ -2080,4 +3349,5 @@ void ExtensionsRegister() {
 	interfaceDataViewers.Add({ "Add waveform...", WaveformAddDialog });
 	interfaceCommands.Add({ .label = nullptr, 
 			.shortcut = { .code = UI_KEYCODE_LETTER('V'), .ctrl = true, .shift = true, .invoke = ViewWindowView } });
+	msgProfSample = ReceiveMessageRegister(ProfSampleBatch);
 }
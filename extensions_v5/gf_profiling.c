@@ -1,7 +1,11 @@
 // ------------- Configuration -------------
 #define GF_PROFILING_BUFFER_BYTES (64 * 1024 * 1024)
+#define GF_PROFILING_CHUNK_BYTES (64 * 1024) // Each thread claims the buffer in chunks of this size.
+#define GF_PROFILING_FUNCTION_TABLE_BITS (16) // Up to 2^16 distinct functions can be recorded.
 #define GF_PROFILING_CLOCK CLOCK_MONOTONIC
-// #define GF_PROFILING_CLOCK CLOCK_THREAD_CPUTIME_ID
+// #define GF_PROFILING_CLOCK CLOCK_THREAD_CPUTIME_ID // Note: threads will not share a timeline.
+// #define GF_PROFILING_USE_RDTSC // Read the x86 time stamp counter instead of calling clock_gettime. Requires an invariant TSC.
+// #define GF_PROFILING_FLIGHT_RECORDER (4) // Record all the time, keeping only this many of the most recent chunks for each thread.
 // -----------------------------------------
 
 /*
@@ -52,6 +56,12 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <stdlib.h>
 #include <time.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifdef GF_PROFILING_USE_RDTSC
+#include <x86intrin.h>
+#endif
 
 #ifdef __cplusplus
 #define GF_PROFILING_EXTERN extern "C"
@@ -59,27 +69,136 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #define GF_PROFILING_EXTERN
 #endif
 
-typedef struct GfProfilingEntry {
-	void *thisFunction;
-	uint64_t timeStamp;
-} GfProfilingEntry;
+// Each event is stored as two variable-length integers:
+// the function's index in gfProfilingFunctions shifted left by 1 (with the low bit set if exiting the function),
+// followed by the number of ticks since the previous event in the chunk.
+#define GF_PROFILING_MAXIMUM_EVENT_BYTES (20)
+
+typedef struct GfProfilingChunk {
+	uint64_t threadID;
+	uint64_t timeStamp; // Of the first event in the chunk.
+	uint64_t bytes; // Only written by the owning thread.
+	uint8_t data[GF_PROFILING_CHUNK_BYTES - 3 * sizeof(uint64_t)];
+} GfProfilingChunk;
 
-static __thread bool gfProfilingEnabledOnThisThread;
-static bool gfProfilingEnabled;
-static size_t gfProfilingBufferSize;
-GfProfilingEntry *gfProfilingBuffer;
-uintptr_t gfProfilingBufferPosition;
+static __thread GfProfilingChunk *gfProfilingChunk;
+static __thread uintptr_t gfProfilingChunkGeneration;
+static __thread uint64_t gfProfilingPreviousTimeStamp;
+#ifdef GF_PROFILING_FLIGHT_RECORDER
+static __thread GfProfilingChunk *gfProfilingRing;
+static __thread uintptr_t gfProfilingRingIndex;
+uint64_t gfProfilingFlightRecorder = GF_PROFILING_FLIGHT_RECORDER;
+#else
+uint64_t gfProfilingFlightRecorder = 0;
+#endif
+static volatile bool gfProfilingEnabled;
+static volatile uintptr_t gfProfilingGeneration;
+GfProfilingChunk *gfProfilingBuffer;
+size_t gfProfilingChunkCapacity;
+size_t gfProfilingChunkBytes;
+uintptr_t gfProfilingChunkCount; // Incremented atomically; may exceed gfProfilingChunkCapacity once the buffer is full.
+void *gfProfilingFunctions[1 << GF_PROFILING_FUNCTION_TABLE_BITS]; // Open addressed; slots are claimed with a compare-and-swap.
+size_t gfProfilingFunctionCapacity = 1 << GF_PROFILING_FUNCTION_TABLE_BITS;
 uint64_t gfProfilingTicksPerMs;
 
+__attribute__((no_instrument_function))
+static inline uint64_t GfProfilingReadClock() {
+#ifdef GF_PROFILING_USE_RDTSC
+	return __rdtsc();
+#else
+	struct timespec time;
+	clock_gettime(GF_PROFILING_CLOCK, &time);
+	return (uint64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+#endif
+}
+
+__attribute__((no_instrument_function))
+static inline uintptr_t GfProfilingFunctionIndex(void *thisFunction) {
+	uintptr_t mask = (1 << GF_PROFILING_FUNCTION_TABLE_BITS) - 1;
+	uintptr_t index = ((uint64_t) (uintptr_t) thisFunction * 0x9E3779B97F4A7C15UL) >> (64 - GF_PROFILING_FUNCTION_TABLE_BITS);
+
+	for (uintptr_t i = 0; i <= mask; i++, index = (index + 1) & mask) {
+		void *existing = __atomic_load_n(&gfProfilingFunctions[index], __ATOMIC_RELAXED);
+		if (existing == thisFunction) return index;
+		if (existing) continue;
+		if (__atomic_compare_exchange_n(&gfProfilingFunctions[index], &existing, thisFunction, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) return index;
+		if (existing == thisFunction) return index;
+	}
+
+	return UINTPTR_MAX;
+}
+
+__attribute__((no_instrument_function))
+static inline uint8_t *GfProfilingWriteVarint(uint8_t *out, uint64_t value) {
+	while (value >= 0x80) *out++ = (uint8_t) value | 0x80, value >>= 7;
+	*out++ = (uint8_t) value;
+	return out;
+}
+
+__attribute__((no_instrument_function))
+static GfProfilingChunk *GfProfilingClaimChunk(uint64_t timeStamp) {
+	GfProfilingChunk *chunk = NULL;
+
+#ifdef GF_PROFILING_FLIGHT_RECORDER
+	if (gfProfilingChunk && gfProfilingChunkGeneration == gfProfilingGeneration) {
+		// Overwrite the oldest chunk in the thread's ring.
+		gfProfilingRingIndex = (gfProfilingRingIndex + 1) % GF_PROFILING_FLIGHT_RECORDER;
+		chunk = &gfProfilingRing[gfProfilingRingIndex];
+	}
+
+	const uintptr_t claimCount = GF_PROFILING_FLIGHT_RECORDER;
+#else
+	const uintptr_t claimCount = 1;
+#endif
+
+	if (!chunk) {
+		gfProfilingChunk = NULL;
+		gfProfilingChunkGeneration = gfProfilingGeneration;
+		if (__atomic_load_n(&gfProfilingChunkCount, __ATOMIC_RELAXED) + claimCount > gfProfilingChunkCapacity) return NULL;
+		uintptr_t index = __atomic_fetch_add(&gfProfilingChunkCount, claimCount, __ATOMIC_RELAXED);
+		if (index + claimCount > gfProfilingChunkCapacity) return NULL;
+		chunk = &gfProfilingBuffer[index];
+		uint64_t threadID = syscall(SYS_gettid);
+
+		for (uintptr_t i = 0; i < claimCount; i++) {
+			chunk[i].threadID = threadID;
+			chunk[i].bytes = 0;
+		}
+
+#ifdef GF_PROFILING_FLIGHT_RECORDER
+		gfProfilingRing = chunk;
+		gfProfilingRingIndex = 0;
+#endif
+	}
+
+	// The debugger may read the chunk at any point, so make sure it never sees old events with the new time stamp.
+	chunk->bytes = 0;
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	chunk->timeStamp = gfProfilingPreviousTimeStamp = timeStamp;
+	return (gfProfilingChunk = chunk);
+}
+
 #define GF_PROFILING_FUNCTION(_exiting) \
 	(void) callSite; \
 	\
-	if (gfProfilingBufferPosition < gfProfilingBufferSize && gfProfilingEnabledOnThisThread) { \
-		GfProfilingEntry *entry = (GfProfilingEntry *) &gfProfilingBuffer[gfProfilingBufferPosition++]; \
-		entry->thisFunction = thisFunction; \
-		struct timespec time; \
-		clock_gettime(GF_PROFILING_CLOCK, &time); \
-		entry->timeStamp = ((uint64_t) time.tv_sec * 1000000000 + time.tv_nsec) | ((uint64_t) _exiting << 63); \
+	if (gfProfilingEnabled) { \
+		uint64_t timeStamp = GfProfilingReadClock(); \
+		uintptr_t functionIndex = GfProfilingFunctionIndex(thisFunction); \
+		GfProfilingChunk *chunk = gfProfilingChunk; \
+		\
+		if (!chunk || chunk->bytes + GF_PROFILING_MAXIMUM_EVENT_BYTES > sizeof(chunk->data) \
+				|| gfProfilingChunkGeneration != gfProfilingGeneration) { \
+			chunk = GfProfilingClaimChunk(timeStamp); \
+		} \
+		\
+		if (chunk && functionIndex != UINTPTR_MAX) { \
+			uint64_t delta = timeStamp > gfProfilingPreviousTimeStamp ? timeStamp - gfProfilingPreviousTimeStamp : 0; \
+			gfProfilingPreviousTimeStamp += delta; \
+			uint8_t *out = chunk->data + chunk->bytes; \
+			out = GfProfilingWriteVarint(out, (uint64_t) functionIndex << 1 | (_exiting)); \
+			out = GfProfilingWriteVarint(out, delta); \
+			chunk->bytes = out - chunk->data; \
+		} \
 	}
 
 GF_PROFILING_EXTERN __attribute__((no_instrument_function))
@@ -94,27 +213,52 @@ void __cyg_profile_func_exit(void *thisFunction, void *callSite) {
 
 GF_PROFILING_EXTERN __attribute__((no_instrument_function))
 void GfProfilingStart() {
+#ifdef GF_PROFILING_FLIGHT_RECORDER
+	// Recording never stops, and other threads may still be writing into the rings they claimed from the buffer,
+	// so the buffer can't be reset here. The debugger shows the recent history instead.
+#else
 	assert(!gfProfilingEnabled);
-	assert(!gfProfilingEnabledOnThisThread);
-	assert(gfProfilingBufferSize);
+	assert(gfProfilingChunkCapacity);
+	gfProfilingChunkCount = 0;
+	gfProfilingGeneration++; // Make every thread claim a new chunk.
 	gfProfilingEnabled = true;
-	gfProfilingEnabledOnThisThread = true;
-	gfProfilingBufferPosition = 0;
+#endif
 }
 
 GF_PROFILING_EXTERN __attribute__((no_instrument_function))
 void GfProfilingStop() {
 	assert(gfProfilingEnabled);
-	assert(gfProfilingEnabledOnThisThread);
+#ifndef GF_PROFILING_FLIGHT_RECORDER
 	gfProfilingEnabled = false;
-	gfProfilingEnabledOnThisThread = false;
+#endif
 }
 
 __attribute__((constructor)) 
 __attribute__((no_instrument_function))
 void GfProfilingInitialise() {
-	gfProfilingBufferSize = GF_PROFILING_BUFFER_BYTES / sizeof(GfProfilingEntry);
-	gfProfilingBuffer = (GfProfilingEntry *) malloc(GF_PROFILING_BUFFER_BYTES);
+	gfProfilingChunkBytes = sizeof(GfProfilingChunk);
+	gfProfilingChunkCapacity = GF_PROFILING_BUFFER_BYTES / sizeof(GfProfilingChunk);
+	gfProfilingBuffer = (GfProfilingChunk *) malloc(gfProfilingChunkCapacity * sizeof(GfProfilingChunk));
+
+#ifdef GF_PROFILING_USE_RDTSC
+	// Calibrate the time stamp counter against the monotonic clock over 10ms.
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	uint64_t startTicks = __rdtsc(), elapsed;
+
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		elapsed = (uint64_t) (end.tv_sec - start.tv_sec) * 1000000000 + end.tv_nsec - start.tv_nsec;
+	} while (elapsed < 10000000);
+
+	gfProfilingTicksPerMs = (__rdtsc() - startTicks) * 1000000 / elapsed;
+#else
 	gfProfilingTicksPerMs = 1000000;
-	assert(gfProfilingBufferSize && gfProfilingBuffer);
+#endif
+
+	assert(gfProfilingChunkCapacity && gfProfilingBuffer);
+
+#ifdef GF_PROFILING_FLIGHT_RECORDER
+	gfProfilingEnabled = true;
+#endif
 }
@@ -17,6 +17,7 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <stdarg.h>
 #include <dirent.h>
 #include <fcntl.h>
@@ -95,7 +96,7 @@ struct MapShort {
 	size_t used, capacity;
 
 	V *At(K key, bool createIfNeeded) {
-		if (used + 1 > capacity / 2) {
+		if (!capacity || (createIfNeeded && used + 1 > capacity / 2)) {
 			MapShort grow = {};
 			grow.capacity = capacity ? (capacity + 1) * 2 - 1 : 15;
 			*(void **) &grow.array = calloc(grow.capacity, sizeof(array[0]));
@@ -190,7 +191,8 @@ struct WatchWindow *firstWatchWindow;
 bool maximize;
 bool confirmCommandConnect = true, confirmCommandKill = true;
 int backtraceCountLimit = 50;
-UIMessage msgReceivedData, msgReceivedLog, msgReceivedControl, msgReceivedNext = (UIMessage) (UI_MSG_USER + 1);
+int sourceCacheCount = 8;
+UIMessage msgReceivedData, msgReceivedLog, msgReceivedControl, msgSourceIndexReady, msgDisassemblyLoadVisible, msgThreadFetchVisible, msgReceivedNext = (UIMessage) (UI_MSG_USER + 1);
 
 // Current file and line:
 
@@ -238,18 +240,25 @@ struct StackEntry {
 	char function[64];
 	char location[sizeof(previousLocation)];
 	uint64_t address;
+	uint64_t stackPointer; // Together with the address, identifies the frame between stops.
 	int id;
 };
 
 Array<StackEntry> stack;
 int stackSelected;
 bool stackChanged;
+bool stackHasMore; // There are older frames that have not been fetched yet.
 
 // Python code:
 
 const char *pythonCode = R"(py
 
 import gdb.types
+import os
+import re
+import signal
+import threading
+import time
 def _gf_hook_string(basic_type):
     hook_string = str(basic_type)
     template_start = hook_string.find('<')
@@ -297,6 +306,137 @@ def gf_valueof(expression, format):
         result = result + '??'
     print(result)
 
+def gf_print_all(expressions):
+    seen = set()
+    for index, expression in enumerate(expressions):
+        if expression in seen: continue
+        seen.add(expression)
+        try: output = '= ' + str(gdb.parse_and_eval(expression))
+        except: continue
+        print('%d\t%s' % (index, output.split('\n')[0]))
+
+def gf_disassembly_windows(pc, size):
+    try:
+        block = gdb.block_for_pc(pc)
+        while block and not block.function: block = block.superblock
+        if not block: return
+        print('%d\t%d' % (block.start, block.end))
+        symtab = gdb.find_pc_line(pc).symtab
+        if not symtab: return
+        addresses = sorted(set(entry.pc for entry in symtab.linetable() if block.start < entry.pc < block.end))
+    except: return
+    last = block.start
+    for address in addresses:
+        if address - last >= size:
+            print(address)
+            last = address
+
+def gf_build_id():
+    for objfile in gdb.objfiles():
+        identity = objfile.build_id
+        if not identity:
+            try: identity = '%s:%d' % (objfile.filename, os.path.getmtime(objfile.filename))
+            except: identity = objfile.filename
+        print(identity)
+    # Where the object files are loaded changes with each process, and the libraries' load addresses are listed by GDB.
+    print(gdb.selected_inferior().pid)
+    try: print(gdb.execute('info sharedlibrary', False, True))
+    except: pass
+
+def gf_symbolize(addresses):
+    for address in addresses:
+        try: name = str(gdb.parse_and_eval('(void *) %d' % address))
+        except: continue
+        filename, line = '', 0
+        try:
+            block = gdb.block_for_pc(address)
+            while block and not block.function: block = block.superblock
+            if block and block.function.symtab: filename, line = block.function.symtab.filename, block.function.line
+        except: pass
+        print('%d\t%d\t%s\t%s' % (address, line, filename, name))
+
+gf_sample_stacks = {}
+gf_sample_starts = {}
+gf_sample_stop_event = None
+
+def gf_sample_on_stop(event):
+    global gf_sample_stop_event
+    gf_sample_stop_event = event
+
+def gf_sample_start():
+    gf_sample_stacks.clear()
+
+def gf_sample_function(frame, caller):
+    pc = frame.pc() - (1 if caller else 0)
+    if pc in gf_sample_starts: return gf_sample_starts[pc]
+    start = pc
+    try:
+        block = gdb.block_for_pc(pc)
+        while block and not block.function: block = block.superblock
+        if block: start = block.start
+        else:
+            offset = re.search(r' \+ (\d+) in section ', gdb.execute('info symbol %d' % pc, to_string=True))
+            if offset: start = pc - int(offset.group(1))
+    except: pass
+    gf_sample_starts[pc] = start
+    return start
+
+def gf_sample(interval_ms, budget_ms):
+    # Prints "sample" for each sample, followed by "thread\tcommon\taddresses" for each thread, with the start addresses of the functions
+    # on its stack from the outermost, skipping the first common ones, which are the same as in the thread's previous sample.
+    # A sample is only taken if it is expected to finish within the budget, judging by how long the previous one took. Walking the stacks
+    # is cut off at three times the budget, so the batch stays within the evaluation timeout; the incomplete sample is then dropped.
+    global gf_sample_stop_event
+    inferior = gdb.selected_inferior()
+    began = time.monotonic()
+    end = began + budget_ms / 1000
+    deadline = began + budget_ms * 3 / 1000
+    took = interval_ms / 1000
+    sampled = False
+    gdb.events.stop.connect(gf_sample_on_stop)
+    try:
+        while time.monotonic() + took < end:
+            if not inferior.pid: print('stopped'); break
+            started = time.monotonic()
+            gf_sample_stop_event = None
+            timer = threading.Timer(interval_ms / 1000, os.kill, (inferior.pid, signal.SIGINT))
+            timer.start()
+            try: gdb.execute('continue', to_string=True)
+            finally: timer.cancel()
+            event = gf_sample_stop_event
+            if not inferior.pid or not isinstance(event, gdb.SignalEvent) or event.stop_signal != 'SIGINT': print('stopped'); break
+            selected = gdb.selected_thread()
+            stacks = {}
+            lines = ['sample']
+            for thread in inferior.threads():
+                thread.switch()
+                stack = []
+                try:
+                    frame = gdb.newest_frame()
+                    while frame and len(stack) < 1000 and time.monotonic() < deadline:
+                        stack.append(gf_sample_function(frame, len(stack) > 0))
+                        frame = frame.older()
+                except gdb.error: pass
+                if time.monotonic() >= deadline: break
+                stack.reverse()
+                previous = gf_sample_stacks.get(thread.ptid[1], [])
+                common = 0
+                while common < len(previous) and common < len(stack) and previous[common] == stack[common]: common += 1
+                stacks[thread.ptid[1]] = stack
+                lines.append('%d\t%d\t%s' % (thread.ptid[1], common, ','.join(str(address) for address in stack[common:])))
+            if selected: selected.switch()
+            if time.monotonic() >= deadline:
+                # If not even one sample fits, the stacks are too deep to sample.
+                if not sampled: print('stopped')
+                break
+            print('\n'.join(lines))
+            gf_sample_stacks.clear()
+            gf_sample_stacks.update(stacks)
+            took = time.monotonic() - started
+            sampled = True
+    finally:
+        gdb.events.stop.disconnect(gf_sample_on_stop)
+
 def gf_addressof(expression):
     value = _gf_value(expression)
     if value == None: return
@@ -337,6 +477,149 @@ def gf_locals():
     for name in names:
         print(name)
 
+def _gf_frame_sp(frame):
+    try: return int(frame.read_register('sp'))
+    except: return 0
+
+def _gf_stack_matches(frame, known, match):
+    # Check that the frames outer to a match are all still the same, without formatting them.
+    index = match + 1
+    while frame and index < len(known):
+        if (frame.pc(), _gf_frame_sp(frame)) != known[index]: return False
+        frame = frame.older()
+        index = index + 1
+    if index < len(known): return False
+    print('=%d' % match)
+    if frame: print('+')
+    return True
+
+def gf_stack(start, count, known):
+    try: frame = gdb.newest_frame()
+    except: return
+    level = 0
+    pairs = dict(((known[index], known[index + 1]), index) for index in range(len(known) - 1))
+    try:
+        while frame and level < start:
+            frame = frame.older()
+            level = level + 1
+        while frame and count > 0:
+            sp = _gf_frame_sp(frame)
+            sal = frame.find_sal()
+            location = ('%s:%d' % (sal.symtab.filename, sal.line)) if sal.symtab else ''
+            print('%d\t0x%x\t0x%x\t%s\t%s' % (level, frame.pc(), sp, frame.name() or '??', location))
+            older = frame.older()
+            if level and older and frame.type() != gdb.INLINE_FRAME:
+                pair = ((frame.pc(), sp), (older.pc(), _gf_frame_sp(older)))
+                if pair in pairs and _gf_stack_matches(older, known, pairs[pair]):
+                    return
+            frame = older
+            level = level + 1
+            count = count - 1
+    except gdb.error:
+        return
+    if frame: print('+')
+
+_gf_threads = {}
+def gf_threads():
+    global _gf_threads
+    try: threads = gdb.selected_inferior().threads()
+    except: return
+    selected = gdb.selected_thread()
+    _gf_threads = {}
+    for thread in threads: _gf_threads[thread.num] = thread
+    for num in sorted(_gf_threads):
+        thread = _gf_threads[num]
+        print('%d\t%d\t%s' % (num, 1 if thread == selected else 0, thread.name or ''))
+
+def gf_thread_frames(ids):
+    selected = gdb.selected_thread()
+    try: selected_frame = gdb.selected_frame()
+    except: selected_frame = None
+    for id in ids:
+        try:
+            _gf_threads[id].switch()
+            frame = gdb.newest_frame()
+            sal = frame.find_sal()
+            location = (' at %s:%d' % (sal.symtab.filename, sal.line)) if sal.symtab else ''
+            print('%d\t0x%x in %s ()%s' % (id, frame.pc(), frame.name() or '??', location))
+        except: print('%d\t??' % id)
+    if selected: selected.switch()
+    if selected_frame: selected_frame.select()
+
+def _gf_parallel_stacks_print(node, depth):
+    for entry in sorted(node.values(), key=lambda entry: -entry[0]):
+        print('%d\t%d\t%d\t%d\t%s\t%s' % (depth, entry[0], entry[1], entry[2], entry[3], entry[4]))
+        _gf_parallel_stacks_print(entry[5], depth + 1)
+
+_gf_parallel_stacks_threads = []
+_gf_parallel_stacks_root = {}
+def gf_parallel_stacks(start, limit, budget_ms):
+    # Threads are merged into the tree until the budget runs out; then "+next" is printed, and the next call continues from that thread.
+    global _gf_parallel_stacks_threads, _gf_parallel_stacks_root
+    if start == 0:
+        try: _gf_parallel_stacks_threads = sorted(gdb.selected_inferior().threads(), key=lambda thread: thread.num)
+        except: return
+        _gf_parallel_stacks_root = {}
+    threads = _gf_parallel_stacks_threads
+    selected = gdb.selected_thread()
+    try: selected_frame = gdb.selected_frame()
+    except: selected_frame = None
+    end = time.monotonic() + budget_ms / 1000
+    index = start
+    while index < len(threads) and (index == start or time.monotonic() < end):
+        thread = threads[index]
+        index = index + 1
+        frames = []
+        try:
+            thread.switch()
+            frame = gdb.newest_frame()
+            while frame and len(frames) < limit:
+                frames.append(frame)
+                frame = frame.older()
+        except gdb.error: pass
+        node = _gf_parallel_stacks_root
+        for level in range(len(frames) - 1, -1, -1):
+            frame = frames[level]
+            if frame.pc() not in node:
+                sal = frame.find_sal()
+                location = ('%s:%d' % (sal.symtab.filename, sal.line)) if sal.symtab else ''
+                node[frame.pc()] = [0, thread.num, level, frame.name() or '??', location, {}]
+            entry = node[frame.pc()]
+            entry[0] = entry[0] + 1
+            node = entry[5]
+    if selected: selected.switch()
+    if selected_frame: selected_frame.select()
+    if index < len(threads):
+        print('+%d' % index)
+        return
+    _gf_parallel_stacks_print(_gf_parallel_stacks_root, 0)
+    _gf_parallel_stacks_threads = []
+    _gf_parallel_stacks_root = {}
+
+def _gf_register_bytes(value):
+    if hasattr(value, 'bytes'): return value.bytes
+    type = value.type.strip_typedefs()
+    if type.code == gdb.TYPE_CODE_ARRAY and type.target().sizeof == 1:
+        return bytes([int(value[i]) & 0xFF for i in range(type.sizeof)])
+    if type.code == gdb.TYPE_CODE_UNION:
+        for field in type.fields():
+            if field.type.sizeof != type.sizeof: continue
+            try: return _gf_register_bytes(value[field.name])
+            except gdb.error: pass
+    raise gdb.error('no byte view')
+
+def gf_vector_registers():
+    try:
+        frame = gdb.selected_frame()
+        registers = frame.architecture().registers('vector')
+    except: return
+    for register in registers:
+        try:
+            value = frame.read_register(register)
+            if value.type.sizeof < 16 or value.type.sizeof > 64: continue
+            print('%s\t%s' % (register.name, _gf_register_bytes(value).hex()))
+        except: pass
+
 end
 )";
 
@@ -350,6 +633,11 @@ int WatchWindowMessage(UIElement *element, UIMessage message, int di, void *dp);
 void CommandInspectLine(void *);
 void WatchRewrite(const char *expression);
 void CopyLayoutToClipboard(void *cp);
+int SourceFindEndOfBlock();
+bool SourceFindOuterFunctionCall(char **start, char **end);
+void SpeculationCancel();
+void SpeculationStart();
+void ExpressionCacheClear();
 
 //////////////////////////////////////////////////////
 // Utilities:
@@ -395,6 +683,28 @@ char *LoadFile(const char *path, size_t *_bytes) {
 	return buffer;
 }
 
+char *MapFile(const char *path, size_t *_bytes, size_t minimumBytes) {
+	// Returns nullptr if the file is smaller than minimumBytes. Release with UnmapFile.
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) return nullptr;
+	struct stat s;
+
+	if (fstat(fd, &s) || !s.st_size || (size_t) s.st_size < minimumBytes) {
+		close(fd);
+		return nullptr;
+	}
+
+	void *pointer = mmap(nullptr, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (pointer == MAP_FAILED) return nullptr;
+	*_bytes = s.st_size;
+	return (char *) pointer;
+}
+
+void UnmapFile(char *pointer, size_t bytes) {
+	munmap(pointer, bytes);
+}
+
 bool INIParse(INIState *s) {
 #define INI_READ(destination, counter, c1, c2) \
 	s->destination = s->buffer, s->counter = 0; \
@@ -429,14 +739,6 @@ bool INIParse(INIState *s) {
 	return false;
 }
 
-int ModifiedRowMessage(UIElement *element, UIMessage message, int di, void *dp) {
-	if (message == UI_MSG_PAINT) {
-		UIDrawBorder((UIPainter *) dp, element->bounds, ui.theme.selected, UI_RECT_1(2));
-	}
-
-	return 0;
-}
-
 int TrafficLightMessage(UIElement *element, UIMessage message, int di, void *dp) {
 	if (message == UI_MSG_PAINT) {
 		UIDrawRectangle((UIPainter *) dp, element->bounds, programRunning ? ui.theme.accent1 : ui.theme.accent2, ui.theme.border, UI_RECT_1(1));
@@ -445,92 +747,6 @@ int TrafficLightMessage(UIElement *element, UIMessage message, int di, void *dp)
 	return 0;
 }
 
-int SourceFindEndOfBlock() {
-	if (!currentLine || currentLine - 1 >= displayCode->lineCount) return -1;
-
-	int tabs = 0;
-
-	for (int i = 0; i < displayCode->lines[currentLine - 1].bytes; i++) {
-		if (isspace(displayCode->content[displayCode->lines[currentLine - 1].offset + i])) tabs++;
-		else break;
-	}
-
-	for (int j = currentLine; j < displayCode->lineCount; j++) {
-		int t = 0;
-
-		for (int i = 0; i < displayCode->lines[j].bytes - 1; i++) {
-			if (isspace(displayCode->content[displayCode->lines[j].offset + i])) t++;
-			else break;
-		}
-
-		if (t < tabs && displayCode->content[displayCode->lines[j].offset + t] == '}') {
-			return j + 1;
-		}
-	}
-
-	return -1;
-}
-
-bool SourceFindOuterFunctionCall(char **start, char **end) {
-	if (!currentLine || currentLine - 1 >= displayCode->lineCount) return false;
-	uintptr_t offset = displayCode->lines[currentLine - 1].offset;
-	bool found = false;
-
-	// Look forwards for the end of the call ");".
-
-	while (offset < displayCode->contentBytes - 1) {
-		if (displayCode->content[offset] == ')' && displayCode->content[offset + 1] == ';') {
-			found = true;
-			break;
-		} else if (displayCode->content[offset] == ';' || displayCode->content[offset] == '{') {
-			break;
-		}
-
-		offset++;
-	}
-
-	if (!found) return false;
-
-	// Look backwards for the matching bracket.
-
-	int level = 0;
-
-	while (offset > 0) {
-		if (displayCode->content[offset] == ')') {
-			level++;
-		} else if (displayCode->content[offset] == '(') {
-			level--;
-			if (level == 0) break;
-		}
-
-		offset--;
-	}
-
-	if (level) return false;
-
-	*start = *end = displayCode->content + offset;
-	found = false;
-	offset--;
-
-	// Look backwards for the start of the function name.
-	// TODO Support function pointers.
-
-	while (offset > 0) {
-		char c = displayCode->content[offset];
-
-		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == ' ' || (c >= '0' && c <= '9')) {
-			// Part of the function name.
-			offset--;
-		} else {
-			*start = displayCode->content + offset + 1;
-			found = true;
-			break;
-		}
-	}
-
-	return found;
-}
-
 UIMessage ReceiveMessageRegister(void (*callback)(char *input)) {
 	receiveMessageTypes.Add({ .message = msgReceivedNext, .callback = callback });
 	msgReceivedNext = (UIMessage) (msgReceivedNext + 1);
@@ -668,6 +884,10 @@ void DebuggerSend(const char *string, bool echo, bool synchronous) {
 
 		evaluateMode = true;
 		pthread_mutex_lock(&evaluateMutex);
+	} else {
+		// Commands from the user may change the program's state.
+		SpeculationCancel();
+		ExpressionCacheClear();
 	}
 
 	if (programRunning) {
@@ -740,56 +960,69 @@ void *ControlPipeThread(void *) {
 	return nullptr;
 }
 
-void DebuggerGetStack() {
-	char buffer[16];
-	StringFormat(buffer, sizeof(buffer), "bt %d", backtraceCountLimit);
-	EvaluateCommand(buffer);
-	stack.Free();
-
-	const char *position = evaluateResult;
-
-	while (*position == '#') {
-		const char *next = position;
-
-		while (true) {
-			next = strchr(next + 1, '\n');
-			if (!next || next[1] == '#') break;
-		}
+bool DebuggerGetStackPage(Array<StackEntry> *previous = nullptr) {
+	// Fetch the next backtraceCountLimit frames after the ones we already have.
+	// If a frame from the previous stop is found again together with its caller, and all the frames outer to it are unchanged, they are reused.
+	// The innermost frame is never matched, since the same breakpoint can be hit with the same stack pointer from a different caller.
+	char buffer[16384];
+	int position = StringFormat(buffer, sizeof(buffer), "py gf_stack(%d,%d,[", stack.Length(), backtraceCountLimit);
+	int sent = 0;
+
+	for (; previous && sent < previous->Length() && position < (int) sizeof(buffer) - 64; sent++) {
+		position += StringFormat(buffer + position, sizeof(buffer) - position, "(0x%lX,0x%lX),",
+				(*previous)[sent].address, (*previous)[sent].stackPointer);
+	}
 
-		if (!next) next = position + strlen(position);
+	StringFormat(buffer + position, sizeof(buffer) - position, "])");
+	EvaluateCommand(buffer);
+	int oldLength = stack.Length();
+	const char *line = evaluateResult;
 
+	while (*line >= '0' && *line <= '9') {
 		StackEntry entry = {};
+		char *end;
+		entry.id = strtol(line, &end, 0);
+		entry.address = strtoul(end + 1, &end, 0);
+		entry.stackPointer = strtoul(end + 1, &end, 0);
+		if (*end != '\t') break;
+		const char *function = end + 1;
+		const char *location = strchr(function, '\t');
+		if (!location) break;
+		const char *next = strchr(location, '\n');
+		if (!next) break;
+		StringFormat(entry.function, sizeof(entry.function), "%.*s", (int) (location - function), function);
+		StringFormat(entry.location, sizeof(entry.location), "%.*s", (int) (next - location - 1), location + 1);
+		stack.Add(entry);
+		line = next + 1;
+	}
 
-		entry.id = strtoul(position + 1, (char **) &position, 0);
-
-		while (*position == ' ' && position < next) position++;
-		bool hasAddress = *position == '0';
-
-		if (hasAddress) {
-			entry.address = strtoul(position, (char **) &position, 0);
-			position += 4;
-		}
-
-		while (*position == ' ' && position < next) position++;
-		const char *functionName = position;
-		position = strchr(position, ' ');
-		if (!position || position >= next) break;
-		StringFormat(entry.function, sizeof(entry.function), "%.*s", (int) (position - functionName), functionName);
+	bool reused = true;
 
-		const char *file = strstr(position, " at ");
+	if (*line == '=' && previous && stack.Length()) {
+		// The helper gives the index of the matching frame in the previous stack, having checked all the frames we sent outer to it.
+		int i = atoi(line + 1);
+		line = strchr(line, '\n');
+		line = line ? line + 1 : "";
+		reused = i >= 0 && i < sent - 1 && 0 == strcmp((*previous)[i].function, stack.Last().function);
 
-		if (file && file < next) {
-			file += 4;
-			const char *end = file;
-			while (*end != '\n' && end < next) end++;
-			StringFormat(entry.location, sizeof(entry.location), "%.*s", (int) (end - file), file);
+		for (int j = i + 1; reused && j < sent; j++) {
+			StackEntry copy = (*previous)[j];
+			copy.id = stack.Length();
+			stack.Add(copy);
 		}
+	}
 
-		stack.Add(entry);
+	// If the matched frames could not be reused, they are fetched with the next page instead.
+	stackHasMore = *line == '+' || !reused;
+	return stack.Length() > oldLength;
+}
 
-		if (!(*next)) break;
-		position = next + 1;
-	}
+void DebuggerGetStack() {
+	Array<StackEntry> previous = stack;
+	stack = {};
+	stackHasMore = false;
+	DebuggerGetStackPage(&previous);
+	previous.Free();
 }
 
 void DebuggerGetBreakpoints() {
@@ -1308,6 +1541,8 @@ void SettingsLoad(bool earlyPass) {
 					selectableSource = atoi(state.value);
 				} else if (0 == strcmp(state.key, "center_execution_pointer")) {
 					centerExecutionPointer = atoi(state.value);
+				} else if (0 == strcmp(state.key, "source_cache_count")) {
+					sourceCacheCount = atoi(state.value);
 				}
 			} else if (0 == strcmp(state.section, "gdb") && !earlyPass) {
 				if (0 == strcmp(state.key, "argument")) {
@@ -1451,6 +1686,7 @@ bool ElementHidden(UIElement *element) {
 
 void MsgReceivedData(char *input) {
 	programRunning = false;
+	ExpressionCacheClear();
 
 	if (firstUpdate) {
 		EvaluateCommand(pythonCode);
@@ -1471,6 +1707,12 @@ void MsgReceivedData(char *input) {
 	}
 
 	if (WatchLoggerUpdate(input)) return;
+
+	if (strstr(input, "Starting program: ")) {
+		DisassemblyCacheClear();
+		ASMWindowsClear();
+	}
+
 	if (showingDisassembly) DisassemblyUpdateLine();
 
 	DebuggerGetStack();
@@ -1491,6 +1733,7 @@ void MsgReceivedData(char *input) {
 	}
 
 	if (trafficLight) UIElementRepaint(&trafficLight->e, nullptr);
+	SpeculationStart();
 }
 
 void MsgReceivedControl(char *input) {
@@ -1512,6 +1755,7 @@ void InterfaceAddBuiltinWindowsAndCommands() {
 	interfaceWindows.Add({ "Source", SourceWindowCreate, SourceWindowUpdate });
 	interfaceWindows.Add({ "Breakpoints", BreakpointsWindowCreate, BreakpointsWindowUpdate });
 	interfaceWindows.Add({ "Registers", RegistersWindowCreate, RegistersWindowUpdate });
+	interfaceWindows.Add({ "VectorRegisters", VectorRegistersWindowCreate, VectorRegistersWindowUpdate });
 	interfaceWindows.Add({ "Watch", WatchWindowCreate, WatchWindowUpdate, WatchWindowFocus });
 	interfaceWindows.Add({ "Locals", LocalsWindowCreate, WatchWindowUpdate, WatchWindowFocus });
 	interfaceWindows.Add({ "Commands", CommandsWindowCreate, nullptr });
@@ -1521,6 +1765,7 @@ void InterfaceAddBuiltinWindowsAndCommands() {
 	interfaceWindows.Add({ "Console", ConsoleWindowCreate, nullptr });
 	interfaceWindows.Add({ "Log", LogWindowCreate, nullptr });
 	interfaceWindows.Add({ "Thread", ThreadWindowCreate, ThreadWindowUpdate });
+	interfaceWindows.Add({ "ParallelStacks", ParallelStacksWindowCreate, ParallelStacksWindowUpdate });
 	interfaceWindows.Add({ "Exe", ExecutableWindowCreate, nullptr });
 	interfaceWindows.Add({ "CmdSearch", CommandSearchWindowCreate, nullptr });
 	interfaceWindows.Add({ "ASM", ASMWindowCreate, ASMWindowUpdate });
@@ -1595,6 +1840,9 @@ void InterfaceAddBuiltinWindowsAndCommands() {
 	msgReceivedData = ReceiveMessageRegister(MsgReceivedData);
 	msgReceivedControl = ReceiveMessageRegister(MsgReceivedControl);
 	msgReceivedLog = ReceiveMessageRegister(LogReceived);
+	msgSourceIndexReady = ReceiveMessageRegister(SourceIndexReceived);
+	msgDisassemblyLoadVisible = ReceiveMessageRegister(DisassemblyLoadVisible);
+	msgThreadFetchVisible = ReceiveMessageRegister(ThreadFetchVisibleFrames);
 }
 
 void InterfaceShowMenu(void *self) {
@@ -21,6 +21,20 @@
 
 #ifdef UI_SSE2
 #include <xmmintrin.h>
+#include <emmintrin.h>
+#endif
+
+#ifdef UI_AVX2
+#include <immintrin.h>
+#endif
+
+#if defined(UI_SSE2) || defined(UI_AVX2)
+#ifdef _MSC_VER
+#include <intrin.h>
+static inline int _UI_COUNT_TRAILING_ZEROS(uint32_t x) { unsigned long index; _BitScanForward(&index, x); return index; }
+#else
+#define _UI_COUNT_TRAILING_ZEROS(x) __builtin_ctz(x)
+#endif
 #endif
 
 #ifdef UI_WINDOWS
@@ -284,6 +298,7 @@ typedef struct UITableGetItem {
 	size_t bufferBytes;
 	int index, column;
 	bool isSelected;
+	bool isHighlighted; // Outlines the row, such as to mark a value that changed.
 } UITableGetItem;
 
 typedef struct UICodeDecorateLine {
@@ -601,12 +616,32 @@ typedef struct UIScrollBar {
 		UIElementRefresh(&element->e);
 
 typedef struct UICodeLine {
-	int offset, bytes;
+	size_t offset;
+	int bytes;
 } UICodeLine;
 
+typedef struct UICodeTokenSpan {
+	uint16_t bytes;
+	uint8_t type;
+} UICodeTokenSpan;
+
+typedef struct UICodeDocument {
+	char *content;
+	size_t contentBytes, indexedBytes;
+	UICodeLine *lines;
+	int lineCount, lineCapacity, columns;
+	void (*releaseContent)(char *content, size_t bytes);
+	double vScrollPosition, hScrollPosition;
+	uint8_t *lineStates;
+	int lineStatesValid, lineStatesCapacity;
+} UICodeDocument;
+
+#define UI_CODE_HIGHLIGHT_CACHE_SIZE (256)
+
 typedef struct UICode {
 #define UI_CODE_NO_MARGIN (1 << 0)
 #define UI_CODE_SELECTABLE (1 << 1)
+#define UI_CODE_LEX_ACROSS_LINES (1 << 2) // Carry block comments and continued preprocessor lines across line breaks.
 	UIElement e;
 	UIScrollBar *vScroll, *hScroll;
 	UICodeLine *lines;
@@ -616,6 +651,12 @@ typedef struct UICode {
 	bool leftDownInMargin;
 	char *content;
 	size_t contentBytes;
+	size_t indexedBytes; // Content past this point has not been split into lines yet.
+	int lineCapacity;
+	void (*releaseContent)(char *content, size_t bytes); // Set for content passed to UICodeSetContentNoCopy.
+	uint8_t *lineStates; // The lexer state at the start of each line, with UI_CODE_LEX_ACROSS_LINES.
+	int lineStatesValid, lineStatesCapacity;
+	struct { int line /* 1-indexed; 0 if empty */, spanCount; UICodeTokenSpan *spans; bool guessed; } highlightCache[UI_CODE_HIGHLIGHT_CACHE_SIZE];
 	int tabSize;
 	int columns;
 	UI_CLOCK_T lastAnimateTime;
@@ -778,7 +819,11 @@ void UICodeFocusLine(UICode *code, int index); // Line numbers are 1-indexed!!
 int UICodeHitTest(UICode *code, int x, int y); // Returns line number; negates if in margin. Returns 0 if not on a line.
 void UICodePositionToByte(UICode *code, int x, int y, int *line, int *byte);
 void UICodeInsertContent(UICode *code, const char *content, ptrdiff_t byteCount, bool replace);
+void UICodeReplaceLines(UICode *code, int from, int count, const char *content, size_t byteCount); // Line numbers are 0-indexed. The content should end with a newline.
+void UICodeSetContentNoCopy(UICode *code, char *content, size_t byteCount, void (*release)(char *content, size_t bytes)); // The content is used in place until it is replaced. Lines are indexed lazily.
 void UICodeMoveCaret(UICode *code, bool backward, bool word);
+void UICodeSwapDocument(UICode *code, UICodeDocument *document); // Exchanges the content, line index and scroll position, so that several documents can be kept loaded.
+void UICodeDocumentFree(UICodeDocument *document);
 
 void UIDrawBlock(UIPainter *painter, UIRectangle rectangle, uint32_t color);
 void UIDrawCircle(UIPainter *painter, int centerX, int centerY, int radius, uint32_t fillColor, uint32_t outlineColor, bool hollow);
@@ -2806,38 +2851,33 @@ int UICodeHitTest(UICode *code, int x, int y) {
 	return inMargin ? -line : line;
 }
 
-int UIDrawStringHighlighted(UIPainter *painter, UIRectangle lineBounds, const char *string, ptrdiff_t bytes, int tabSize, UIStringSelection *selection) {
-	if (bytes == -1) bytes = _UIStringLength(string);
-	if (bytes > 10000) bytes = 10000;
+typedef enum _UICodeTokenType {
+	UI_CODE_TOKEN_TYPE_DEFAULT,
+	UI_CODE_TOKEN_TYPE_COMMENT,
+	UI_CODE_TOKEN_TYPE_STRING,
+	UI_CODE_TOKEN_TYPE_NUMBER,
+	UI_CODE_TOKEN_TYPE_OPERATOR,
+	UI_CODE_TOKEN_TYPE_PREPROCESSOR,
+} _UICodeTokenType;
 
-	typedef enum _UICodeTokenType {
-		UI_CODE_TOKEN_TYPE_DEFAULT,
-		UI_CODE_TOKEN_TYPE_COMMENT,
-		UI_CODE_TOKEN_TYPE_STRING,
-		UI_CODE_TOKEN_TYPE_NUMBER,
-		UI_CODE_TOKEN_TYPE_OPERATOR,
-		UI_CODE_TOKEN_TYPE_PREPROCESSOR,
-	} _UICodeTokenType;
+#define UI_CODE_LEX_STATE_DEFAULT (0)
+#define UI_CODE_LEX_STATE_COMMENT (1) // Inside a /* */ comment.
+#define UI_CODE_LEX_STATE_PREPROCESSOR (2) // Inside a preprocessor directive continued with a backslash.
 
-	uint32_t colors[] = {
-		ui.theme.codeDefault,
-		ui.theme.codeComment,
-		ui.theme.codeString,
-		ui.theme.codeNumber,
-		ui.theme.codeOperator,
-		ui.theme.codePreprocessor,
-	};
+int _UICodeLexLine(const char *string, ptrdiff_t bytes, int state, UICodeTokenSpan *spans, int maximumSpans, int *_spanCount) {
+	// Splits the line into spans of token types, and returns the state at the start of the next line.
+	// If there are more than maximumSpans spans, the last span is extended to the end of the line.
 
-	int lineHeight = UIMeasureStringHeight();
-	int x = lineBounds.l;
-	int y = (lineBounds.t + lineBounds.b - lineHeight) / 2;
-	int ti = 0;
-	_UICodeTokenType tokenType = UI_CODE_TOKEN_TYPE_DEFAULT;
-	bool inComment = false, inIdentifier = false, inChar = false, startedString = false, startedPreprocessor = false;
+	_UICodeTokenType tokenType = state == UI_CODE_LEX_STATE_COMMENT ? UI_CODE_TOKEN_TYPE_COMMENT
+		: state == UI_CODE_LEX_STATE_PREPROCESSOR ? UI_CODE_TOKEN_TYPE_PREPROCESSOR : UI_CODE_TOKEN_TYPE_DEFAULT;
+	bool inComment = state == UI_CODE_LEX_STATE_COMMENT, inIdentifier = false, inChar = false, startedString = false;
+	bool startedPreprocessor = state == UI_CODE_LEX_STATE_PREPROCESSOR;
 	uint32_t last = 0;
-	int j = 0;
+	int spanCount = 0;
 
 	while (bytes) {
+		const char *characterStart = string;
+
 #ifdef UI_UNICODE
 		ptrdiff_t bytesConsumed;
 		int c = Utf8GetCodePoint(string, bytes, &bytesConsumed);
@@ -2905,13 +2945,72 @@ int UIDrawStringHighlighted(UIPainter *painter, UIRectangle lineBounds, const ch
 			}
 		}
 
+		int characterBytes = string - characterStart;
+
+		if (spanCount && (spans[spanCount - 1].type == tokenType || spanCount == maximumSpans)) {
+			spans[spanCount - 1].bytes += characterBytes;
+		} else if (spanCount < maximumSpans) {
+			spans[spanCount].bytes = characterBytes;
+			spans[spanCount].type = tokenType;
+			spanCount++;
+		}
+	}
+
+	if (_spanCount) *_spanCount = spanCount;
+
+	if (tokenType == UI_CODE_TOKEN_TYPE_COMMENT && inComment) {
+		// The comment may have been closed by the last two characters.
+		bool closed = ((last >> 8) & 0xFF) == '*' && (last & 0xFF) == '/';
+		return !closed ? UI_CODE_LEX_STATE_COMMENT : startedPreprocessor && (last & 0xFF) == '\\' ? UI_CODE_LEX_STATE_PREPROCESSOR : UI_CODE_LEX_STATE_DEFAULT;
+	} else if (tokenType == UI_CODE_TOKEN_TYPE_PREPROCESSOR && (last & 0xFF) == '\\') {
+		return UI_CODE_LEX_STATE_PREPROCESSOR;
+	} else {
+		return UI_CODE_LEX_STATE_DEFAULT;
+	}
+}
+
+int _UIDrawTokenSpans(UIPainter *painter, UIRectangle lineBounds, const char *string, ptrdiff_t bytes, int tabSize, UIStringSelection *selection,
+		const UICodeTokenSpan *spans, int spanCount) {
+	uint32_t colors[] = {
+		ui.theme.codeDefault,
+		ui.theme.codeComment,
+		ui.theme.codeString,
+		ui.theme.codeNumber,
+		ui.theme.codeOperator,
+		ui.theme.codePreprocessor,
+	};
+
+	int lineHeight = UIMeasureStringHeight();
+	int x = lineBounds.l;
+	int y = (lineBounds.t + lineBounds.b - lineHeight) / 2;
+	int ti = 0;
+	int j = 0;
+	int span = 0, spanBytesLeft = spanCount ? spans[0].bytes : 0;
+
+	while (bytes) {
+		const char *characterStart = string;
+
+#ifdef UI_UNICODE
+		ptrdiff_t bytesConsumed;
+		int c = Utf8GetCodePoint(string, bytes, &bytesConsumed);
+		UI_ASSERT(bytesConsumed > 0);
+		string += bytesConsumed;
+		bytes -= bytesConsumed;
+#else
+		char c = *string++;
+		bytes--;
+#endif
+
+		while (!spanBytesLeft && span + 1 < spanCount) spanBytesLeft = spans[++span].bytes;
+		uint32_t color = span < spanCount ? colors[spans[span].type] : ui.theme.codeDefault;
+		spanBytesLeft -= string - characterStart;
 		int oldX = x;
 
 		if (c == '\t') {
 			x += ui.activeFont->glyphWidth, ti++;
 			while (ti % tabSize) x += ui.activeFont->glyphWidth, ti++, j++;
 		} else {
-			UIDrawGlyph(painter, x, y, c, colors[tokenType]);
+			UIDrawGlyph(painter, x, y, c, color);
 			x += ui.activeFont->glyphWidth, ti++;
 		}
 
@@ -2934,6 +3033,92 @@ int UIDrawStringHighlighted(UIPainter *painter, UIRectangle lineBounds, const ch
 	return x;
 }
 
+int UIDrawStringHighlighted(UIPainter *painter, UIRectangle lineBounds, const char *string, ptrdiff_t bytes, int tabSize, UIStringSelection *selection) {
+	if (bytes == -1) bytes = _UIStringLength(string);
+	if (bytes > 10000) bytes = 10000;
+	UICodeTokenSpan spans[256];
+	int spanCount;
+	_UICodeLexLine(string, bytes, UI_CODE_LEX_STATE_DEFAULT, spans, sizeof(spans) / sizeof(spans[0]), &spanCount);
+	return _UIDrawTokenSpans(painter, lineBounds, string, bytes, tabSize, selection, spans, spanCount);
+}
+
+void _UICodeHighlightInvalidate(UICode *code) {
+	for (int i = 0; i < UI_CODE_HIGHLIGHT_CACHE_SIZE; i++) {
+		UI_FREE(code->highlightCache[i].spans);
+		code->highlightCache[i].spans = NULL;
+		code->highlightCache[i].line = 0;
+	}
+}
+
+#define UI_CODE_LEX_LOOKBACK_LINES (256)
+#define UI_CODE_LEX_CHUNK_BYTES (1024 * 1024)
+
+int _UICodeLexLineState(UICode *code, int line, int state) {
+	// Returns the lexer state at the start of the line after this one.
+	int bytes = code->lines[line].bytes > 10000 ? 10000 : code->lines[line].bytes;
+	return _UICodeLexLine(code->content + code->lines[line].offset, bytes, state, NULL, 0, NULL);
+}
+
+void _UICodeLexLines(UICode *code, int untilLine, size_t maximumBytes) {
+	// Lex forwards from the last line with a known start state, until either untilLine has one, or maximumBytes have been lexed.
+	if (!code->lineCount) return;
+
+	if (untilLine >= code->lineStatesCapacity) {
+		code->lineStatesCapacity = untilLine * 2 + 1024;
+		code->lineStates = (uint8_t *) UI_REALLOC(code->lineStates, code->lineStatesCapacity);
+	}
+
+	if (!code->lineStatesValid) {
+		code->lineStates[0] = UI_CODE_LEX_STATE_DEFAULT;
+		code->lineStatesValid = 1;
+	}
+
+	for (size_t lexed = 0; code->lineStatesValid <= untilLine && lexed < maximumBytes; code->lineStatesValid++) {
+		lexed += code->lines[code->lineStatesValid - 1].bytes + 1;
+		code->lineStates[code->lineStatesValid] = _UICodeLexLineState(code, code->lineStatesValid - 1, code->lineStates[code->lineStatesValid - 1]);
+	}
+}
+
+int _UICodeLineStartState(UICode *code, int line, bool *guessed) {
+	*guessed = false;
+
+	if (~code->e.flags & UI_CODE_LEX_ACROSS_LINES) {
+		return UI_CODE_LEX_STATE_DEFAULT;
+	} else if (line > code->lineStatesValid + UI_CODE_LEX_LOOKBACK_LINES) {
+		// The line is far past where the background pass has reached, such as after jumping deep into a large file.
+		// Rather than lex everything before it while painting, assume nothing continues from more than a few hundred lines before.
+		// The spans are replaced once the background pass reaches the line.
+		int state = UI_CODE_LEX_STATE_DEFAULT;
+		for (int i = line - UI_CODE_LEX_LOOKBACK_LINES; i < line; i++) state = _UICodeLexLineState(code, i, state);
+		*guessed = true;
+		return state;
+	} else {
+		_UICodeLexLines(code, line, SIZE_MAX);
+		return code->lineStates[line];
+	}
+}
+
+void _UICodeGetTokenSpans(UICode *code, int line, UICodeTokenSpan **spans, int *spanCount) {
+	// Lines are direct-mapped into the cache, so the visible lines never evict each other.
+	int slot = line % UI_CODE_HIGHLIGHT_CACHE_SIZE;
+
+	if (code->highlightCache[slot].line != line + 1 || (code->highlightCache[slot].guessed && line < code->lineStatesValid)) {
+		int bytes = code->lines[line].bytes > 10000 ? 10000 : code->lines[line].bytes;
+		UICodeTokenSpan *buffer = (UICodeTokenSpan *) UI_MALLOC(sizeof(UICodeTokenSpan) * (bytes + 1));
+		int count;
+		bool guessed;
+		_UICodeLexLine(code->content + code->lines[line].offset, bytes, _UICodeLineStartState(code, line, &guessed), buffer, bytes + 1, &count);
+		UI_FREE(code->highlightCache[slot].spans);
+		code->highlightCache[slot].spans = (UICodeTokenSpan *) UI_REALLOC(buffer, sizeof(UICodeTokenSpan) * (count + 1));
+		code->highlightCache[slot].spanCount = count;
+		code->highlightCache[slot].line = line + 1;
+		code->highlightCache[slot].guessed = guessed;
+	}
+
+	*spans = code->highlightCache[slot].spans;
+	*spanCount = code->highlightCache[slot].spanCount;
+}
+
 void _UICodeUpdateSelection(UICode *code) {
 	bool swap = code->selection[3].line < code->selection[2].line
 		|| (code->selection[3].line == code->selection[2].line && code->selection[3].offset < code->selection[2].offset);
@@ -2955,22 +3140,116 @@ void _UICodeSetVerticalMotionColumn(UICode *code, bool restore) {
 void _UICodeCopyText(void *cp) {
 	UICode *code = (UICode *) cp;
 
-	int from = code->lines[code->selection[0].line].offset + code->selection[0].offset;
-	int to = code->lines[code->selection[1].line].offset + code->selection[1].offset;
+	size_t from = code->lines[code->selection[0].line].offset + code->selection[0].offset;
+	size_t to = code->lines[code->selection[1].line].offset + code->selection[1].offset;
 
 	if (from != to) {
 		char *pasteText = (char *) UI_CALLOC(to - from + 2);
-		for (int i = from; i < to; i++) pasteText[i - from] = code->content[i];
+		for (size_t i = from; i < to; i++) pasteText[i - from] = code->content[i];
 		_UIClipboardWriteText(code->e.window, pasteText);
 	}
 }
 
+#define UI_CODE_INDEX_LINES_AHEAD (1000)
+#define UI_CODE_INDEX_CHUNK_BYTES (4 * 1024 * 1024)
+
+bool _UICodeHasBackgroundWork(UICode *code) {
+	return code->indexedBytes < code->contentBytes
+		|| ((code->e.flags & UI_CODE_LEX_ACROSS_LINES) && code->lineStatesValid < code->lineCount);
+}
+
+size_t _UICodeFindNewline(const char *content, size_t i, size_t end) {
+	// Returns the index of the next newline at or after i, or end if there isn't one.
+
+#ifdef UI_AVX2
+	__m256i newlines32 = _mm256_set1_epi8('\n');
+
+	for (; i + 32 <= end; i += 32) {
+		__m256i block = _mm256_loadu_si256((const __m256i *) (content + i));
+		uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newlines32));
+		if (mask) return i + _UI_COUNT_TRAILING_ZEROS(mask);
+	}
+#endif
+
+#ifdef UI_SSE2
+	__m128i newlines16 = _mm_set1_epi8('\n');
+
+	for (; i + 16 <= end; i += 16) {
+		__m128i block = _mm_loadu_si128((const __m128i *) (content + i));
+		uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newlines16));
+		if (mask) return i + _UI_COUNT_TRAILING_ZEROS(mask);
+	}
+#endif
+
+	while (i < end && content[i] != '\n') i++;
+	return i;
+}
+
+void _UICodeIndexLines(UICode *code, int untilLine, size_t maximumBytes) {
+	// Split the content into lines until either untilLine exists, or maximumBytes have been scanned.
+	size_t end = code->contentBytes;
+	size_t stop = end - code->indexedBytes > maximumBytes ? code->indexedBytes + maximumBytes : end;
+	bool wasIncomplete = code->indexedBytes < end;
+
+	while (code->indexedBytes < stop || (code->indexedBytes < end && code->lineCount <= untilLine)) {
+		size_t i = _UICodeFindNewline(code->content, code->indexedBytes, end);
+
+		if (code->lineCount == code->lineCapacity) {
+			code->lineCapacity = code->lineCapacity ? code->lineCapacity * 2 : 1024;
+			code->lines = (UICodeLine *) UI_REALLOC(code->lines, sizeof(UICodeLine) * code->lineCapacity);
+		}
+
+		UICodeLine line = { 0 };
+		line.offset = code->indexedBytes;
+		line.bytes = i - code->indexedBytes > 0x7FFFFFFF ? 0x7FFFFFFF : i - code->indexedBytes; // Only the start of very long lines is shown.
+		if (line.bytes > code->columns) code->columns = line.bytes;
+		code->lines[code->lineCount++] = line;
+		code->indexedBytes = i + 1 < end ? i + 1 : end;
+	}
+
+	if (wasIncomplete && !_UICodeHasBackgroundWork(code) && code->e.window->pressed != &code->e) {
+		UIElementAnimate(&code->e, true);
+	}
+}
+
+void _UICodeReleaseContent(UICode *code) {
+	if (code->releaseContent) code->releaseContent(code->content, code->contentBytes);
+	else UI_FREE(code->content);
+	UI_FREE(code->lines);
+	UI_FREE(code->lineStates);
+	code->releaseContent = NULL;
+	code->content = NULL;
+	code->lines = NULL;
+	code->lineStates = NULL;
+	code->contentBytes = code->indexedBytes = 0;
+	code->lineCount = code->lineCapacity = 0;
+	code->lineStatesValid = code->lineStatesCapacity = 0;
+	code->columns = 0;
+	_UICodeHighlightInvalidate(code);
+}
+
+void UICodeSetContentNoCopy(UICode *code, char *content, size_t byteCount, void (*release)(char *content, size_t bytes)) {
+	code->useVerticalMotionColumn = false;
+	_UICodeReleaseContent(code);
+	code->selection[0].line = code->selection[1].line = 0;
+	code->selection[0].offset = code->selection[1].offset = 0;
+	code->content = content;
+	code->contentBytes = byteCount;
+	code->releaseContent = release;
+
+	// Index enough lines to fill the view now, and the rest in the background.
+	_UICodeIndexLines(code, UI_CODE_INDEX_LINES_AHEAD, 0);
+	if (_UICodeHasBackgroundWork(code)) UIElementAnimate(&code->e, false);
+	UIElementRefresh(&code->e);
+}
+
 int _UICodeMessage(UIElement *element, UIMessage message, int di, void *dp) {
 	UICode *code = (UICode *) element;
 
 	if (message == UI_MSG_LAYOUT) {
 		UIFont *previousFont = UIFontActivate(code->font);
 		int scrollBarSize = UI_SIZE_SCROLL_BAR * code->e.window->scale;
+		_UICodeIndexLines(code, (code->vScroll->position + UI_RECT_HEIGHT(element->bounds)) / UIMeasureStringHeight() + 1, 0);
 		code->vScroll->maximum = code->lineCount * UIMeasureStringHeight();
 		code->hScroll->maximum = code->columns * code->font->glyphWidth; // TODO This doesn't take into account tab sizes!
 		int vSpace = code->vScroll->page = UI_RECT_HEIGHT(element->bounds);
@@ -3074,8 +3353,13 @@ int _UICodeMessage(UIElement *element, UIMessage message, int di, void *dp) {
 			if (code->hScroll) lineBounds.l -= (int64_t) code->hScroll->position;
 			selection.carets[0] = i == code->selection[0].line ? _UICodeByteToColumn(code, i, code->selection[0].offset) : 0;
 			selection.carets[1] = i == code->selection[1].line ? _UICodeByteToColumn(code, i, code->selection[1].offset) : code->lines[i].bytes;
-			int x = UIDrawStringHighlighted(painter, lineBounds, code->content + code->lines[i].offset, code->lines[i].bytes, code->tabSize,
-					element->window->focused == element && i >= code->selection[0].line && i <= code->selection[1].line ? &selection : NULL);
+			UICodeTokenSpan *spans;
+			int spanCount;
+			_UICodeGetTokenSpans(code, i, &spans, &spanCount);
+			int x = _UIDrawTokenSpans(painter, lineBounds, code->content + code->lines[i].offset,
+					code->lines[i].bytes > 10000 ? 10000 : code->lines[i].bytes, code->tabSize,
+					element->window->focused == element && i >= code->selection[0].line && i <= code->selection[1].line ? &selection : NULL,
+					spans, spanCount);
 			int y = (lineBounds.t + lineBounds.b - UIMeasureStringHeight()) / 2;
 
 			if (element->window->focused == element && i >= code->selection[0].line && i < code->selection[1].line) {
@@ -3107,7 +3391,10 @@ int _UICodeMessage(UIElement *element, UIMessage message, int di, void *dp) {
 			return UI_CURSOR_TEXT;
 		}
 	} else if (message == UI_MSG_LEFT_UP) {
+		if (!_UICodeHasBackgroundWork(code)) UIElementAnimate(element, true);
+	} else if (message == UI_MSG_DESTROY) {
 		UIElementAnimate(element, true);
+		_UICodeReleaseContent(code);
 	} else if (message == UI_MSG_LEFT_DOWN && code->lineCount) {
 		int hitTest = UICodeHitTest(code, element->window->cursorX, element->window->cursorY);
 		code->leftDownInMargin = hitTest < 0;
@@ -3120,6 +3407,14 @@ int _UICodeMessage(UIElement *element, UIMessage message, int di, void *dp) {
 			code->lastAnimateTime = UI_CLOCK();
 		}
 	} else if (message == UI_MSG_ANIMATE) {
+		if (_UICodeHasBackgroundWork(code)) {
+			// Index the lines, and then find the lexer state at the start of each, a chunk at a time.
+			if (code->indexedBytes < code->contentBytes) _UICodeIndexLines(code, -1, UI_CODE_INDEX_CHUNK_BYTES);
+			else _UICodeLexLines(code, code->lineCount - 1, UI_CODE_LEX_CHUNK_BYTES);
+			if (!_UICodeHasBackgroundWork(code) && element->window->pressed != element) UIElementAnimate(element, true);
+			UIElementRefresh(element);
+		}
+
 		if (element->window->pressed == element && element->window->pressedButton == 1 && code->lineCount && !code->leftDownInMargin) {
 			UI_CLOCK_T previous = code->lastAnimateTime;
 			UI_CLOCK_T current = UI_CLOCK();
@@ -3277,12 +3572,55 @@ void UICodeMoveCaret(UICode *code, bool backward, bool word) {
 	_UICodeUpdateSelection(code);
 }
 
+void UICodeSwapDocument(UICode *code, UICodeDocument *document) {
+	UICodeDocument old = { code->content, code->contentBytes, code->indexedBytes, code->lines,
+		code->lineCount, code->lineCapacity, code->columns, code->releaseContent, code->vScroll->position, code->hScroll->position,
+		code->lineStates, code->lineStatesValid, code->lineStatesCapacity };
+	code->content = document->content, code->contentBytes = document->contentBytes, code->indexedBytes = document->indexedBytes;
+	code->lines = document->lines, code->lineCount = document->lineCount, code->lineCapacity = document->lineCapacity;
+	code->columns = document->columns, code->releaseContent = document->releaseContent;
+	code->vScroll->position = document->vScrollPosition, code->hScroll->position = document->hScrollPosition;
+	code->lineStates = document->lineStates, code->lineStatesValid = document->lineStatesValid;
+	code->lineStatesCapacity = document->lineStatesCapacity;
+	*document = old;
+	_UICodeHighlightInvalidate(code);
+
+	code->useVerticalMotionColumn = false;
+	code->moveScrollToFocusNextLayout = false;
+	code->selection[0].line = code->selection[1].line = 0;
+	code->selection[0].offset = code->selection[1].offset = 0;
+	if (_UICodeHasBackgroundWork(code)) UIElementAnimate(&code->e, false);
+	UIElementRefresh(&code->e);
+}
+
+void UICodeDocumentFree(UICodeDocument *document) {
+	if (document->releaseContent) document->releaseContent(document->content, document->contentBytes);
+	else UI_FREE(document->content);
+	UI_FREE(document->lines);
+	UI_FREE(document->lineStates);
+	*document = (UICodeDocument) { 0 };
+}
+
 void UICodeFocusLine(UICode *code, int index) {
+	_UICodeIndexLines(code, index + UI_CODE_INDEX_LINES_AHEAD, 0);
 	code->focused = index - 1;
 	code->moveScrollToFocusNextLayout = true;
 	UIElementRefresh(&code->e);
 }
 
+void _UICodeTakeContent(UICode *code) {
+	// Modifying the content needs all existing lines, and content we own.
+	_UICodeIndexLines(code, -1, code->contentBytes);
+
+	if (code->releaseContent) {
+		char *copy = (char *) UI_MALLOC(code->contentBytes);
+		UI_MEMMOVE(copy, code->content, code->contentBytes);
+		code->releaseContent(code->content, code->contentBytes);
+		code->releaseContent = NULL;
+		code->content = copy;
+	}
+}
+
 void UICodeInsertContent(UICode *code, const char *content, ptrdiff_t byteCount, bool replace) {
 	code->useVerticalMotionColumn = false;
 
@@ -3292,20 +3630,12 @@ void UICodeInsertContent(UICode *code, const char *content, ptrdiff_t byteCount,
 		byteCount = _UIStringLength(content);
 	}
 
-	if (byteCount > 1000000000) {
-		byteCount = 1000000000;
-	}
-
 	if (replace) {
-		UI_FREE(code->content);
-		UI_FREE(code->lines);
-		code->content = NULL;
-		code->lines = NULL;
-		code->contentBytes = 0;
-		code->lineCount = 0;
-		code->columns = 0;
+		_UICodeReleaseContent(code);
 		code->selection[0].line = code->selection[1].line = 0;
 		code->selection[0].offset = code->selection[1].offset = 0;
+	} else {
+		_UICodeTakeContent(code);
 	}
 
 	code->content = (char *) UI_REALLOC(code->content, code->contentBytes + byteCount);
@@ -3314,39 +3644,69 @@ void UICodeInsertContent(UICode *code, const char *content, ptrdiff_t byteCount,
 		return;
 	}
 
-	int lineCount = content[byteCount - 1] != '\n';
+	// Copy the content, and then split it into lines and measure the columns in a single pass.
+	UI_MEMMOVE(code->content + code->contentBytes, content, byteCount);
+	code->contentBytes += byteCount;
+	_UICodeIndexLines(code, -1, code->contentBytes);
 
-	for (int i = 0; i < byteCount; i++) {
-		code->content[i + code->contentBytes] = content[i];
+	if (!replace) {
+		code->vScroll->position = code->lineCount * UIMeasureStringHeight();
+	}
 
-		if (content[i] == '\n') {
-			lineCount++;
-		}
+	if (_UICodeHasBackgroundWork(code)) UIElementAnimate(&code->e, false);
+	UIFontActivate(previousFont);
+	UIElementRepaint(&code->e, NULL);
+}
+
+void UICodeReplaceLines(UICode *code, int from, int count, const char *content, size_t byteCount) {
+	_UICodeTakeContent(code);
+	if (from > code->lineCount) from = code->lineCount;
+	if (from + count > code->lineCount) count = code->lineCount - from;
+
+	// Splice the content in place of the lines.
+	size_t start = from < code->lineCount ? code->lines[from].offset : code->contentBytes;
+	size_t end = from + count < code->lineCount ? code->lines[from + count].offset : code->contentBytes;
+	size_t newBytes = code->contentBytes - (end - start) + byteCount;
+	if (newBytes > code->contentBytes) code->content = (char *) UI_REALLOC(code->content, newBytes);
+	UI_MEMMOVE(code->content + start + byteCount, code->content + end, code->contentBytes - end);
+	UI_MEMMOVE(code->content + start, content, byteCount);
+	code->contentBytes = code->indexedBytes = newBytes;
+
+	// Count the new lines, and then move the lines after them into place.
+	int newCount = 0;
+
+	for (size_t i = _UICodeFindNewline(content, 0, byteCount); i < byteCount; i = _UICodeFindNewline(content, i + 1, byteCount)) {
+		newCount++;
 	}
 
-	code->lines = (UICodeLine *) UI_REALLOC(code->lines, sizeof(UICodeLine) * (code->lineCount + lineCount));
-	int offset = 0, lineIndex = 0;
+	if (byteCount && content[byteCount - 1] != '\n') newCount++;
+	int lineCount = code->lineCount - count + newCount;
 
-	for (intptr_t i = 0; i <= byteCount && lineIndex < lineCount; i++) {
-		if (content[i] == '\n' || i == byteCount) {
-			UICodeLine line = { 0 };
-			line.offset = offset + code->contentBytes;
-			line.bytes = i - offset;
-			if (line.bytes > code->columns) code->columns = line.bytes;
-			code->lines[code->lineCount + lineIndex] = line;
-			lineIndex++;
-			offset = i + 1;
-		}
+	if (lineCount > code->lineCapacity) {
+		code->lineCapacity = lineCount * 2;
+		code->lines = (UICodeLine *) UI_REALLOC(code->lines, sizeof(UICodeLine) * code->lineCapacity);
 	}
 
-	code->lineCount += lineCount;
-	code->contentBytes += byteCount;
+	UI_MEMMOVE(code->lines + from + newCount, code->lines + from + count, sizeof(UICodeLine) * (code->lineCount - from - count));
+	code->lineCount = lineCount;
 
-	if (!replace) {
-		code->vScroll->position = code->lineCount * UIMeasureStringHeight();
+	for (int i = from + newCount; i < lineCount; i++) {
+		code->lines[i].offset += byteCount - (end - start);
 	}
 
-	UIFontActivate(previousFont);
+	size_t offset = start;
+
+	for (int i = from; i < from + newCount; i++) {
+		size_t next = _UICodeFindNewline(code->content, offset, start + byteCount);
+		code->lines[i].offset = offset;
+		code->lines[i].bytes = next - offset;
+		if (code->lines[i].bytes > code->columns) code->columns = code->lines[i].bytes;
+		offset = next + 1;
+	}
+
+	if (code->lineStatesValid > from + 1) code->lineStatesValid = from + 1;
+	_UICodeHighlightInvalidate(code);
+	if (_UICodeHasBackgroundWork(code)) UIElementAnimate(&code->e, false);
 	UIElementRepaint(&code->e, NULL);
 }
 
@@ -3561,8 +3921,10 @@ int _UITableMessage(UIElement *element, UIMessage message, int di, void *dp) {
 			row.b = row.t + rowHeight;
 			m.index = i;
 			m.isSelected = false;
+			m.isHighlighted = false;
 			m.column = 0;
 			int bytes = UIElementMessage(element, UI_MSG_TABLE_GET_ITEM, 0, &m);
+			bool isHighlighted = m.isHighlighted;
 
 			uint32_t rowFlags = (m.isSelected ? UI_DRAW_CONTROL_STATE_SELECTED : 0) | (hovered == i ? UI_DRAW_CONTROL_STATE_HOVERED : 0);
 			UIDrawControl(painter, row, UI_DRAW_CONTROL_TABLE_ROW | rowFlags, NULL, 0, 0, element->window->scale);
@@ -3582,6 +3944,7 @@ int _UITableMessage(UIElement *element, UIMessage message, int di, void *dp) {
 				cell.l += table->columnWidths[j] + UI_SIZE_TABLE_COLUMN_GAP * table->e.window->scale;
 			}
 
+			if (isHighlighted) UIDrawBorder(painter, row, ui.theme.selected, UI_RECT_1((int) (2 * element->window->scale)));
 			row.t += rowHeight;
 		}
 
@@ -20,6 +20,420 @@ int inspectModeRestoreLine;
 UIRectangle displayCurrentLineBounds;
 const char *disassemblyCommand = "disas /s";
 
+// Files at least this large are mapped rather than read.
+// Smaller files are copied, so they can be safely truncated by an editor while they're in use.
+#define SOURCE_MAP_MINIMUM_BYTES (16 * 1024 * 1024)
+
+struct SourceCacheEntry {
+	char path[PATH_MAX]; // The real path.
+	time_t modifiedTime;
+	UICodeDocument document;
+};
+
+Array<SourceCacheEntry> sourceCache; // Most recently used last.
+bool displayCodeShowsFile; // Whether displayCode contains currentFileFull, as of currentFileLoadedTime.
+time_t currentFileLoadedTime;
+
+void SourceCacheStore() {
+	// Move the current file out of displayCode into the cache, so switching back to it is just a swap.
+	if (!displayCodeShowsFile || sourceCacheCount <= 0) return;
+	displayCodeShowsFile = false;
+
+	if (sourceCache.Length() >= sourceCacheCount) {
+		UICodeDocumentFree(&sourceCache[0].document);
+		sourceCache.Delete(0);
+	}
+
+	SourceCacheEntry entry = {};
+	StringFormat(entry.path, sizeof(entry.path), "%s", currentFileFull);
+	entry.modifiedTime = currentFileLoadedTime;
+	UICodeSwapDocument(displayCode, &entry.document);
+	sourceCache.Add(entry);
+}
+
+bool SourceCacheRestore(const char *path, time_t modifiedTime) {
+	for (int i = 0; i < sourceCache.Length(); i++) {
+		if (strcmp(sourceCache[i].path, path)) continue;
+		SourceCacheEntry entry = sourceCache[i];
+		sourceCache.Delete(i);
+
+		if (entry.modifiedTime != modifiedTime) {
+			UICodeDocumentFree(&entry.document);
+			return false;
+		}
+
+		UICodeDocument previous = entry.document;
+		UICodeSwapDocument(displayCode, &previous);
+		UICodeDocumentFree(&previous);
+		return true;
+	}
+
+	return false;
+}
+
+struct SourceIndexBrace {
+	int openLine, closeLine; // 1-indexed; closeLine is 0 if the brace is never closed.
+	int parent; // The enclosing brace pair, or -1.
+};
+
+struct SourceIndexParen {
+	size_t open, close; // Offsets into the file.
+};
+
+struct SourceIndexSpan {
+	int offset, bytes; // Relative to the start of the line.
+};
+
+struct SourceIndexLine {
+	int brace; // The innermost brace pair open at the start of the line, or -1.
+	int expressionsStart, expressionsCount; // Candidate expressions for inspect line mode.
+};
+
+struct SourceIndex {
+	char path[PATH_MAX]; // The real path.
+	time_t modifiedTime;
+	size_t bytes;
+	bool valid;
+	Array<SourceIndexLine> lines;
+	Array<SourceIndexBrace> braces; // The outermost pairs are the function extents.
+	Array<SourceIndexParen> parens; // Sorted by close.
+	Array<SourceIndexSpan> expressions;
+};
+
+Array<SourceIndex *> sourceIndices; // Most recently built last.
+char sourceIndexPending[PATH_MAX];
+time_t sourceIndexPendingTime;
+
+bool InspectIsTokenCharacter(char c) {
+	return isalpha(c) || c == '_';
+}
+
+void SourceFindExpressions(const char *string, int bytes, Array<SourceIndexSpan> *expressions) {
+	// Find the expressions that inspect line mode should evaluate.
+
+	for (int i = 0; i < bytes; i++) {
+		if ((i != bytes - 1 && InspectIsTokenCharacter(string[i]) && !InspectIsTokenCharacter(string[i + 1])) || string[i] == ']') {
+			int b = 0, j = i;
+
+			for (; j >= 0; j--) {
+				if (j && string[j] == '>' && string[j - 1] == '-') {
+					j--;
+				} else if (string[j] == ']') {
+					b++;
+				} else if (string[j] == '[' && b) {
+					b--;
+				} else if (InspectIsTokenCharacter(string[j]) || b || string[j] == '.') {
+				} else {
+					j++;
+					break;
+				}
+			}
+
+			char buffer[256];
+			if (i - j + 1 > 255 || j < 1) continue;
+			StringFormat(buffer, sizeof(buffer), "%.*s", i - j + 1, string + j);
+
+			if (0 == strcmp(buffer, "true") || 0 == strcmp(buffer, "false") || 0 == strcmp(buffer, "if") || 0 == strcmp(buffer, "for")
+					|| 0 == strcmp(buffer, "else") || 0 == strcmp(buffer, "while") || 0 == strcmp(buffer, "int")
+					|| 0 == strcmp(buffer, "char") || 0 == strcmp(buffer, "switch") || 0 == strcmp(buffer, "float")) {
+				continue;
+			}
+
+			expressions->Add({ j, i - j + 1 });
+		}
+	}
+}
+
+void SourceIndexBuild(SourceIndex *index, const char *content, size_t bytes) {
+	// Skips comments, strings and preprocessor directives, so that braces and parentheses in them are not matched.
+	Array<int> braceStack = {};
+	Array<size_t> parenStack = {};
+	bool lineComment = false, blockComment = false, preprocessor = false, lineStart = true;
+	char quote = 0, previous = 0;
+	size_t lineOffset = 0;
+	int line = 1;
+
+	index->lines.Add({ -1, 0, 0 });
+
+	for (size_t i = 0; i <= bytes; i++) {
+		char c = i == bytes ? '\n' : content[i];
+		char next = i + 1 < bytes ? content[i + 1] : 0;
+
+		if (c == '\n') {
+			SourceIndexLine *entry = &index->lines.Last();
+			entry->expressionsStart = index->expressions.Length();
+			SourceFindExpressions(content + lineOffset, i - lineOffset, &index->expressions);
+			entry->expressionsCount = index->expressions.Length() - entry->expressionsStart;
+			if (i == bytes) break;
+
+			if (previous != '\\') preprocessor = false, quote = 0;
+			lineComment = false, lineStart = true, previous = 0;
+			lineOffset = i + 1, line++;
+			index->lines.Add({ braceStack.Length() ? braceStack.Last() : -1, 0, 0 });
+			continue;
+		}
+
+		if (c != '\r') previous = c;
+
+		if (lineComment) {
+		} else if (blockComment) {
+			if (c == '*' && next == '/') blockComment = false, i++;
+		} else if (quote) {
+			if (c == '\\' && next != '\n') i++;
+			else if (c == quote) quote = 0;
+		} else if (c == '/' && next == '/') {
+			lineComment = true;
+		} else if (c == '/' && next == '*') {
+			blockComment = true, i++;
+		} else if (c == '"' || c == '\'') {
+			quote = c;
+		} else if (lineStart && c == '#') {
+			preprocessor = true;
+		} else if (preprocessor) {
+		} else if (c == '{') {
+			index->braces.Add({ line, 0, braceStack.Length() ? braceStack.Last() : -1 });
+			braceStack.Add(index->braces.Length() - 1);
+		} else if (c == '}' && braceStack.Length()) {
+			index->braces[braceStack.Last()].closeLine = line;
+			braceStack.Pop();
+		} else if (c == '(') {
+			parenStack.Add(i);
+		} else if (c == ')' && parenStack.Length()) {
+			index->parens.Add({ parenStack.Last(), i });
+			parenStack.Pop();
+		}
+
+		if (!isspace(c)) lineStart = false;
+	}
+
+	braceStack.Free();
+	parenStack.Free();
+	index->bytes = bytes;
+	index->valid = true;
+}
+
+void SourceIndexFree(SourceIndex *index) {
+	index->lines.Free();
+	index->braces.Free();
+	index->parens.Free();
+	index->expressions.Free();
+	free(index);
+}
+
+void *SourceIndexThread(void *context) {
+	SourceIndex *index = (SourceIndex *) context;
+	size_t bytes = 0;
+	char *mapped = MapFile(index->path, &bytes, SOURCE_MAP_MINIMUM_BYTES);
+	char *content = mapped ? mapped : LoadFile(index->path, &bytes);
+	struct stat s;
+
+	if (content && !stat(index->path, &s) && s.st_mtime == index->modifiedTime) {
+		SourceIndexBuild(index, content, bytes);
+	}
+
+	if (mapped) UnmapFile(mapped, bytes);
+	else free(content);
+	UIWindowPostMessage(windowMain, msgSourceIndexReady, index);
+	return nullptr;
+}
+
+SourceIndex *SourceIndexCurrent() {
+	// Returns nullptr if the index for the displayed file hasn't been built yet.
+	if (showingDisassembly || !displayCodeShowsFile) return nullptr;
+
+	for (int i = 0; i < sourceIndices.Length(); i++) {
+		SourceIndex *index = sourceIndices[i];
+
+		if (0 == strcmp(index->path, currentFileFull) && index->modifiedTime == currentFileLoadedTime
+				&& index->bytes == displayCode->contentBytes) {
+			return index;
+		}
+	}
+
+	return nullptr;
+}
+
+void SourceIndexRequest() {
+	if (showingDisassembly || !displayCodeShowsFile || SourceIndexCurrent()) return;
+	if (0 == strcmp(sourceIndexPending, currentFileFull) && sourceIndexPendingTime == currentFileLoadedTime) return;
+
+	SourceIndex *index = (SourceIndex *) calloc(1, sizeof(SourceIndex));
+	StringFormat(index->path, sizeof(index->path), "%s", currentFileFull);
+	index->modifiedTime = currentFileLoadedTime;
+	StringFormat(sourceIndexPending, sizeof(sourceIndexPending), "%s", currentFileFull);
+	sourceIndexPendingTime = currentFileLoadedTime;
+
+	pthread_t thread;
+
+	if (pthread_create(&thread, nullptr, SourceIndexThread, index)) {
+		SourceIndexFree(index);
+	} else {
+		pthread_detach(thread);
+	}
+}
+
+void SourceIndexReceived(char *input) {
+	SourceIndex *index = (SourceIndex *) input;
+
+	if (0 == strcmp(sourceIndexPending, index->path) && sourceIndexPendingTime == index->modifiedTime) {
+		sourceIndexPending[0] = 0;
+	}
+
+	if (!index->valid) {
+		SourceIndexFree(index);
+		return;
+	}
+
+	for (int i = 0; i < sourceIndices.Length(); i++) {
+		if (0 == strcmp(sourceIndices[i]->path, index->path)) {
+			SourceIndexFree(sourceIndices[i]);
+			sourceIndices.Delete(i);
+			break;
+		}
+	}
+
+	if (sourceIndices.Length() >= (sourceCacheCount > 1 ? sourceCacheCount : 1)) {
+		SourceIndexFree(sourceIndices[0]);
+		sourceIndices.Delete(0);
+	}
+
+	sourceIndices.Add(index);
+
+	if (SourceIndexCurrent() == index) {
+		currentEndOfBlock = SourceFindEndOfBlock();
+		UIElementRefresh(&displayCode->e);
+	}
+}
+
+int SourceIndexFindParen(SourceIndex *index, size_t close) {
+	// Returns the first pair closed at or after the offset.
+	int low = 0, high = index->parens.Length();
+
+	while (low < high) {
+		int middle = (low + high) / 2;
+		if (index->parens[middle].close < close) low = middle + 1;
+		else high = middle;
+	}
+
+	return low;
+}
+
+int SourceFindEndOfBlock() {
+	if (!currentLine || currentLine - 1 >= displayCode->lineCount) return -1;
+
+	if (SourceIndex *index = SourceIndexCurrent()) {
+		if (currentLine > index->lines.Length()) return -1;
+
+		for (int i = index->lines[currentLine - 1].brace; i != -1; i = index->braces[i].parent) {
+			if (index->braces[i].closeLine > currentLine) {
+				return index->braces[i].closeLine;
+			}
+		}
+
+		return -1;
+	}
+
+	// The index hasn't been built yet, so guess from the indentation.
+
+	int tabs = 0;
+
+	for (int i = 0; i < displayCode->lines[currentLine - 1].bytes; i++) {
+		if (isspace(displayCode->content[displayCode->lines[currentLine - 1].offset + i])) tabs++;
+		else break;
+	}
+
+	for (int j = currentLine; j < displayCode->lineCount; j++) {
+		int t = 0;
+
+		for (int i = 0; i < displayCode->lines[j].bytes - 1; i++) {
+			if (isspace(displayCode->content[displayCode->lines[j].offset + i])) t++;
+			else break;
+		}
+
+		if (t < tabs && displayCode->content[displayCode->lines[j].offset + t] == '}') {
+			return j + 1;
+		}
+	}
+
+	return -1;
+}
+
+bool SourceFindOuterFunctionCall(char **start, char **end) {
+	if (!currentLine || currentLine - 1 >= displayCode->lineCount) return false;
+	uintptr_t offset = displayCode->lines[currentLine - 1].offset;
+	bool found = false;
+
+	if (SourceIndex *index = SourceIndexCurrent()) {
+		// Find the first call ended by ");" after the start of the line. It must start on this line or enclose it.
+		size_t lineEnd = offset + displayCode->lines[currentLine - 1].bytes;
+
+		for (int i = SourceIndexFindParen(index, offset); i < index->parens.Length(); i++) {
+			SourceIndexParen *paren = &index->parens[i];
+			if (paren->close + 1 >= displayCode->contentBytes || displayCode->content[paren->close + 1] != ';') continue;
+			if (paren->open > lineEnd) return false;
+			offset = paren->open;
+			found = true;
+			break;
+		}
+
+		if (!found) return false;
+	} else {
+		// Look forwards for the end of the call ");".
+
+		while (offset < displayCode->contentBytes - 1) {
+			if (displayCode->content[offset] == ')' && displayCode->content[offset + 1] == ';') {
+				found = true;
+				break;
+			} else if (displayCode->content[offset] == ';' || displayCode->content[offset] == '{') {
+				break;
+			}
+
+			offset++;
+		}
+
+		if (!found) return false;
+
+		// Look backwards for the matching bracket.
+
+		int level = 0;
+
+		while (offset > 0) {
+			if (displayCode->content[offset] == ')') {
+				level++;
+			} else if (displayCode->content[offset] == '(') {
+				level--;
+				if (level == 0) break;
+			}
+
+			offset--;
+		}
+
+		if (level) return false;
+	}
+
+	*start = *end = displayCode->content + offset;
+	found = false;
+	offset--;
+
+	// Look backwards for the start of the function name.
+	// TODO Support function pointers.
+
+	while (offset > 0) {
+		char c = displayCode->content[offset];
+
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == ' ' || (c >= '0' && c <= '9')) {
+			// Part of the function name.
+			offset--;
+		} else {
+			*start = displayCode->content + offset + 1;
+			found = true;
+			break;
+		}
+	}
+
+	return found;
+}
+
 bool DisplaySetPosition(const char *file, int line, bool useGDBToGetFullPath) {
 	if (showingDisassembly) {
 		return false;
@@ -47,32 +461,45 @@ bool DisplaySetPosition(const char *file, int line, bool useGDBToGetFullPath) {
 	}
 
 	bool reloadFile = false;
+	time_t modifiedTime = 0;
 
 	if (file) {
 		if (strcmp(currentFile, file)) {
 			reloadFile = true;
 		}
 
-		struct stat buf;
+		struct stat buf = {};
 
 		if (!stat(file, &buf) && buf.st_mtime != currentFileReadTime) {
 			reloadFile = true;
 		}
 
-		currentFileReadTime = buf.st_mtime;
+		currentFileReadTime = modifiedTime = buf.st_mtime;
 	}
 
 	bool changed = false;
 
 	if (reloadFile) {
 		currentLine = 0;
+		SourceCacheStore();
 		StringFormat(currentFile, 4096, "%s", file);
 		realpath(currentFile, currentFileFull);
+	}
 
+	if (reloadFile && SourceCacheRestore(currentFileFull, modifiedTime)) {
+		displayCodeShowsFile = true;
+		currentFileLoadedTime = modifiedTime;
+		changed = true;
+		autoPrintResult[0] = 0;
+	} else if (reloadFile) {
+		// Large files are mapped rather than read, and split into lines lazily.
 		size_t bytes;
-		char *buffer2 = LoadFile(file, &bytes);
+		char *mapped = MapFile(file, &bytes, SOURCE_MAP_MINIMUM_BYTES);
+		char *buffer2 = mapped ? nullptr : LoadFile(file, &bytes);
 
-		if (!buffer2) {
+		if (mapped) {
+			UICodeSetContentNoCopy(displayCode, mapped, bytes, UnmapFile);
+		} else if (!buffer2) {
 			char buffer3[4096];
 			StringFormat(buffer3, 4096, "The file '%s' (from '%s') could not be loaded.", file, originalFile);
 			UICodeInsertContent(displayCode, buffer3, -1, true);
@@ -81,6 +508,9 @@ bool DisplaySetPosition(const char *file, int line, bool useGDBToGetFullPath) {
 			free(buffer2);
 		}
 
+		displayCodeShowsFile = mapped || buffer2;
+		currentFileLoadedTime = modifiedTime;
+
 		changed = true;
 		autoPrintResult[0] = 0;
 	}
@@ -91,6 +521,7 @@ bool DisplaySetPosition(const char *file, int line, bool useGDBToGetFullPath) {
 		changed = true;
 	}
 
+	SourceIndexRequest();
 	currentEndOfBlock = SourceFindEndOfBlock();
 	UIElementRefresh(&displayCode->e);
 
@@ -108,34 +539,73 @@ void DisplaySetPositionFromStack() {
 	}
 }
 
-void DisassemblyLoad() {
-	EvaluateCommand(disassemblyCommand);
+struct DisassemblyLine {
+	uint64_t address;
+	int line; // 1-indexed, from the start of the window.
+};
+
+struct DisassemblyWindow {
+	uint64_t low, high; // Instructions starting in [low, high).
+	char *text; // nullptr if the window hasn't been disassembled yet.
+	size_t bytes;
+	int lineStart, lineCount; // Where the window is shown in displayCode.
+	Array<DisassemblyLine> lines; // Sorted by address.
+};
 
-	if (!strstr(evaluateResult, "Dump of assembler code for function")) {
-		char buffer[32];
-		StringFormat(buffer, sizeof(buffer), "disas $pc,+1000");
-		EvaluateCommand(buffer);
+struct DisassemblyRange {
+	uint64_t low, high; // The addresses of the first and last instructions.
+	Array<DisassemblyWindow> windows; // Sorted by address. Very large functions are split up and disassembled lazily.
+};
+
+#define DISASSEMBLY_CACHE_COUNT (16)
+#define DISASSEMBLY_WINDOW_BYTES (4096)
+#define DISASSEMBLY_LAZY_THRESHOLD (16 * DISASSEMBLY_WINDOW_BYTES) // Functions smaller than this are disassembled in one go.
+Array<DisassemblyRange> disassemblyCache; // Most recently used last.
+bool disassemblyCacheShown; // Whether displayCode contains the last range in the cache.
+bool disassemblyLoadQueued;
+uint64_t disassemblyFocusAddress;
+
+void DisassemblyRangeFree(DisassemblyRange *range) {
+	for (int i = 0; i < range->windows.Length(); i++) {
+		free(range->windows[i].text);
+		range->windows[i].lines.Free();
 	}
 
+	range->windows.Free();
+}
+
+void DisassemblyCacheClear() {
+	for (int i = 0; i < disassemblyCache.Length(); i++) DisassemblyRangeFree(&disassemblyCache[i]);
+	disassemblyCache.Free();
+	disassemblyCacheShown = false;
+}
+
+int DisassemblyLineCompare(const void *a, const void *b) {
+	uint64_t left = ((const DisassemblyLine *) a)->address, right = ((const DisassemblyLine *) b)->address;
+	return left < right ? -1 : left > right;
+}
+
+bool DisassemblyParse(DisassemblyWindow *window) {
+	// Parses the output of disas in evaluateResult into the window.
 	char *end = strstr(evaluateResult, "End of assembler dump.");
 
 	if (!end) {
 		printf("Disassembly failed. GDB output:\n%s\n", evaluateResult);
-		return;
+		return false;
 	}
 
 	char *start = strstr(evaluateResult, ":\n");
 
 	if (!start) {
 		printf("Disassembly failed. GDB output:\n%s\n", evaluateResult);
-		return;
+		return false;
 	}
 
 	start += 2;
 
 	if (start >= end) {
 		printf("Disassembly failed. GDB output:\n%s\n", evaluateResult);
-		return;
+		return false;
 	}
 
 	char *pointer = strstr(start, "=> ");
@@ -145,39 +615,273 @@ void DisassemblyLoad() {
 		pointer[1] = ' ';
 	}
 
-	UICodeInsertContent(displayCode, start, end - start, true);
+	// Build the address to line table. Lines without an address contain source code.
+
+	int lineIndex = 0;
+
+	for (const char *line = start, *next; line < end; line = next + 1, lineIndex++) {
+		next = strchr(line, '\n');
+		if (!next || next > end) next = end;
+		const char *address = line;
+		while (address < next && *address == ' ') address++;
+
+		if (next - address > 2 && address[0] == '0' && address[1] == 'x') {
+			window->lines.Add({ .address = strtoull(address, nullptr, 0), .line = lineIndex + 1 });
+		}
+	}
+
+	qsort(window->lines.array, window->lines.Length(), sizeof(DisassemblyLine), DisassemblyLineCompare);
+	window->lineCount = lineIndex;
+	window->bytes = end - start;
+	window->text = (char *) malloc(window->bytes);
+	memcpy(window->text, start, window->bytes);
+	return true;
 }
 
-void DisassemblyUpdateLine() {
+bool DisassemblyLoadWindow(DisassemblyWindow *window) {
+	char buffer[256];
+	StringFormat(buffer, sizeof(buffer), "%s 0x%lx,0x%lx", disassemblyCommand, window->low, window->high);
+	EvaluateCommand(buffer);
+	if (DisassemblyParse(window)) return true;
+
+	// Show the error in place of the window, so that we don't try to load it again.
+	const char *format = "    <0x%lx-0x%lx could not be disassembled>\n";
+	window->lines.Free();
+	window->bytes = snprintf(nullptr, 0, format, window->low, window->high);
+	window->text = (char *) malloc(window->bytes + 1);
+	snprintf(window->text, window->bytes + 1, format, window->low, window->high);
+	window->lineCount = 1;
+	return false;
+}
+
+void DisassemblyLoadShownWindow(DisassemblyRange *range, DisassemblyWindow *window) {
+	// Load a window of the range shown in displayCode, and replace its placeholder.
+	int previousLineCount = window->lineCount;
+	DisassemblyLoadWindow(window);
+	UICodeReplaceLines(displayCode, window->lineStart, previousLineCount, window->text, window->bytes);
+
+	for (DisassemblyWindow *next = window + 1; next < range->windows.array + range->windows.Length(); next++) {
+		next->lineStart += window->lineCount - previousLineCount;
+	}
+}
+
+void DisassemblyShow() {
+	// Show the last range in the cache, with a placeholder for each window that hasn't been loaded.
+	const char *placeholderFormat = "    <0x%lx-0x%lx not yet disassembled>\n";
+	DisassemblyRange *range = &disassemblyCache.Last();
+	size_t bytes = 0;
+	int lineStart = 0;
+
+	for (int i = 0; i < range->windows.Length(); i++) {
+		DisassemblyWindow *window = &range->windows[i];
+		if (!window->text) window->lineCount = 1;
+		window->lineStart = lineStart;
+		lineStart += window->lineCount;
+		bytes += window->text ? window->bytes : snprintf(nullptr, 0, placeholderFormat, window->low, window->high);
+	}
+
+	char *buffer = (char *) malloc(bytes + 1);
+	size_t position = 0;
+
+	for (int i = 0; i < range->windows.Length(); i++) {
+		DisassemblyWindow *window = &range->windows[i];
+
+		if (window->text) {
+			memcpy(buffer + position, window->text, window->bytes);
+			position += window->bytes;
+		} else {
+			position += snprintf(buffer + position, bytes + 1 - position, placeholderFormat, window->low, window->high);
+		}
+	}
+
+	double scroll = displayCode->vScroll->position;
+	int focused = displayCode->focused;
+	UICodeInsertContent(displayCode, buffer, position, true);
+	displayCode->vScroll->position = scroll;
+	displayCode->focused = focused;
+	disassemblyCacheShown = true;
+	free(buffer);
+}
+
+bool DisassemblyLoad() {
 	EvaluateCommand("p $pc");
 	char *address = strstr(evaluateResult, "0x");
+	uint64_t pc = address ? strtoull(address, nullptr, 0) : 0;
+	DisassemblyRange range = {};
+
+	// For very large functions, only disassemble the window containing $pc for now.
+	// The windows are split at addresses from the line table, since they are known to start instructions.
+	char buffer[128];
+	StringFormat(buffer, sizeof(buffer), "py gf_disassembly_windows(%lu, %d)", pc, DISASSEMBLY_WINDOW_BYTES);
+	if (pc) EvaluateCommand(buffer);
+	char *end;
+	uint64_t low = pc ? strtoull(evaluateResult, &end, 10) : 0;
+	uint64_t high = low && *end == '\t' ? strtoull(end + 1, &end, 10) : 0;
+
+	if (high - low > DISASSEMBLY_LAZY_THRESHOLD && strchr(end, '\n')) {
+		for (const char *line = strchr(end, '\n') + 1; *line >= '0' && *line <= '9'; ) {
+			uint64_t split = strtoull(line, &end, 10);
+			if (*end != '\n') break;
+			range.windows.Add({ .low = low, .high = split });
+			low = split, line = end + 1;
+		}
 
-	if (address) {
-		char *addressEnd;
-		uint64_t a = strtoul(address, &addressEnd, 0);
+		range.windows.Add({ .low = low, .high = high });
+	}
 
-		for (int i = 0; i < 2; i++) {
-			// Look for the line in the disassembly.
+	if (range.windows.Length() > 1) {
+		range.low = range.windows.First().low;
+		range.high = high - 1;
 
-			bool found = false;
+		for (int i = 0; i < range.windows.Length(); i++) {
+			if (pc >= range.windows[i].low && pc < range.windows[i].high) {
+				DisassemblyLoadWindow(&range.windows[i]);
+			}
+		}
+	} else {
+		range.windows.Free();
+		DisassemblyWindow window = {};
+		EvaluateCommand(disassemblyCommand);
 
-			for (int i = 0; i < displayCode->lineCount; i++) {
-				uint64_t b = strtoul(displayCode->content + displayCode->lines[i].offset + 3, &addressEnd, 0);
+		if (!strstr(evaluateResult, "Dump of assembler code for function")) {
+			char buffer[32];
+			StringFormat(buffer, sizeof(buffer), "disas $pc,+1000");
+			EvaluateCommand(buffer);
+		}
 
-				if (a == b) {
-					UICodeFocusLine(displayCode, i + 1);
-					autoPrintExpressionLine = i;
-					found = true;
-					break;
-				}
-			}
+		if (!DisassemblyParse(&window) || !window.lines.Length()) {
+			free(window.text);
+			window.lines.Free();
+			return false;
+		}
 
-			if (!found) {
-				// Reload the disassembly.
-				DisassemblyLoad();
-			} else {
-				break;
-			}
+		range.low = window.lines.First().address;
+		range.high = window.lines.Last().address;
+		window.low = range.low, window.high = range.high + 1;
+		range.windows.Add(window);
+	}
+
+	if (disassemblyCache.Length() == DISASSEMBLY_CACHE_COUNT) {
+		DisassemblyRangeFree(&disassemblyCache[0]);
+		disassemblyCache.Delete(0);
+	}
+
+	disassemblyCache.Add(range);
+	DisassemblyShow();
+	return true;
+}
+
+int DisassemblyFindLine(DisassemblyRange *range, uint64_t address) {
+	// Returns the 1-indexed line of the instruction in displayCode, or 0 if it isn't in the range, which must be shown.
+	int low = 0, high = range->windows.Length() - 1;
+
+	while (low < high) {
+		int middle = (low + high + 1) / 2;
+		if (range->windows[middle].low <= address) low = middle;
+		else high = middle - 1;
+	}
+
+	DisassemblyWindow *window = &range->windows[low];
+
+	if (!window->text) {
+		DisassemblyLoadShownWindow(range, window);
+	}
+
+	low = 0, high = window->lines.Length() - 1;
+
+	while (low <= high) {
+		int middle = (low + high) / 2;
+
+		if (window->lines[middle].address == address) {
+			return window->lineStart + window->lines[middle].line;
+		} else if (window->lines[middle].address < address) {
+			low = middle + 1;
+		} else {
+			high = middle - 1;
+		}
+	}
+
+	return 0;
+}
+
+int DisassemblyCacheFind(uint64_t address) {
+	// Returns the 1-indexed line of the instruction, moving its range to the end of the cache, or 0 if it isn't cached.
+
+	for (int i = disassemblyCache.Length() - 1; i >= 0; i--) {
+		DisassemblyRange *range = &disassemblyCache[i];
+		if (address < range->low || address > range->high) continue;
+
+		if (i != disassemblyCache.Length() - 1) {
+			DisassemblyRange copy = *range;
+			disassemblyCache.Delete(i);
+			disassemblyCache.Add(copy);
+			disassemblyCacheShown = false;
+			range = &disassemblyCache.Last();
+		}
+
+		if (!disassemblyCacheShown) DisassemblyShow();
+		int line = DisassemblyFindLine(range, address);
+		if (line) return line;
+	}
+
+	return 0;
+}
+
+int DisassemblyVisibleWindows(bool load) {
+	// Returns the number of windows in view that haven't been disassembled, optionally loading them.
+	if (!showingDisassembly || !disassemblyCacheShown || !disassemblyCache.Length()) return 0;
+	DisassemblyRange *range = &disassemblyCache.Last();
+	if (range->windows.Length() == 1) return 0;
+	UIFont *previousFont = UIFontActivate(displayCode->font);
+	int lineHeight = UIMeasureStringHeight();
+	UIFontActivate(previousFont);
+	int first = displayCode->vScroll->position / lineHeight;
+	int last = first + UI_RECT_HEIGHT(displayCode->e.bounds) / lineHeight + 1;
+	int count = 0;
+
+	for (int i = 0; i < range->windows.Length(); i++) {
+		DisassemblyWindow *window = &range->windows[i];
+		if (window->text || window->lineStart > last || window->lineStart + window->lineCount <= first) continue;
+		if (load) DisassemblyLoadShownWindow(range, window);
+		count++;
+	}
+
+	return count;
+}
+
+void DisassemblyLoadVisible(char *) {
+	disassemblyLoadQueued = false;
+	if (!DisassemblyVisibleWindows(true)) return;
+
+	// Windows above the view weren't loaded, so the scroll position is still correct.
+	// The execution pointer may have moved down, though.
+	int line = disassemblyFocusAddress ? DisassemblyFindLine(&disassemblyCache.Last(), disassemblyFocusAddress) : 0;
+	displayCode->focused = line - 1;
+	autoPrintExpressionLine = line - 1;
+	UIElementRefresh(&displayCode->e);
+}
+
+void DisassemblyQueueLoadVisible() {
+	// Called while painting, so the windows are loaded afterwards and their placeholders are shown meanwhile.
+	if (disassemblyLoadQueued || !DisassemblyVisibleWindows(false)) return;
+	disassemblyLoadQueued = true;
+	UIWindowPostMessage(windowMain, msgDisassemblyLoadVisible, nullptr);
+}
+
+void DisassemblyUpdateLine() {
+	EvaluateCommand("p $pc");
+	char *address = strstr(evaluateResult, "0x");
+
+	if (address) {
+		// Only disassemble again if the address isn't in any of the cached ranges.
+		uint64_t a = strtoull(address, nullptr, 0);
+		int line = DisassemblyCacheFind(a);
+		if (!line && DisassemblyLoad()) line = DisassemblyCacheFind(a);
+
+		if (line) {
+			UICodeFocusLine(displayCode, line);
+			autoPrintExpressionLine = line - 1;
+			disassemblyFocusAddress = a;
 		}
 
 		UIElementRefresh(&displayCode->e);
@@ -189,11 +893,14 @@ void CommandToggleDisassembly(void *) {
 	autoPrintResultLine = 0;
 	autoPrintExpression[0] = 0;
 	displayCode->e.flags ^= UI_CODE_NO_MARGIN;
+	// Comment markers in disassembly (e.g. in the source lines of "disas /s") must not carry over to the following lines.
+	displayCode->e.flags ^= UI_CODE_LEX_ACROSS_LINES;
 
 	if (showingDisassembly) {
+		SourceCacheStore();
 		UICodeInsertContent(displayCode, "Disassembly could not be loaded.\nPress Ctrl+D to return to source view.", -1, true);
+		disassemblyCacheShown = false;
 		displayCode->tabSize = 8;
-		DisassemblyLoad();
 		DisassemblyUpdateLine();
 	} else {
 		currentLine = -1;
@@ -214,6 +921,8 @@ void CommandSetDisassemblyMode(void *) {
 	if (0 == strcmp(newMode, "With source"))      disassemblyCommand = "disas /s";
 	if (0 == strcmp(newMode, "Source centric"))   disassemblyCommand = "disas /m";
 
+	DisassemblyCacheClear();
+
 	if (showingDisassembly) {
 		CommandToggleDisassembly(nullptr);
 		CommandToggleDisassembly(nullptr);
@@ -345,6 +1054,7 @@ int DisplayCodeMessage(UIElement *element, UIMessage message, int di, void *dp)
 		}
 	} else if (message == UI_MSG_PAINT) {
 		element->messageClass(element, message, di, dp);
+		if (showingDisassembly) DisassemblyQueueLoadVisible();
 
 		if (inInspectLineMode) {
 			UIFont *previousFont = UIFontActivate(code->font);
@@ -395,7 +1105,7 @@ int DisplayCodeMessage(UIElement *element, UIMessage message, int di, void *dp)
 }
 
 UIElement *SourceWindowCreate(UIElement *parent) {
-	displayCode = UICodeCreate(parent, selectableSource ? UI_CODE_SELECTABLE : 0);
+	displayCode = UICodeCreate(parent, UI_CODE_LEX_ACROSS_LINES | (selectableSource ? UI_CODE_SELECTABLE : 0));
 	displayCode->font = fontCode;
 	displayCode->e.messageUser = DisplayCodeMessage;
 	displayCode->centerExecutionPointer = centerExecutionPointer;
@@ -595,63 +1305,193 @@ void SourceWindowUpdate(const char *data, UIElement *element) {
 	UIElementRefresh(element);
 }
 
-bool InspectIsTokenCharacter(char c) {
-	return isalpha(c) || c == '_';
+MapShort<uint64_t, char *> expressionCache; // The values of expressions at this stop, stored as "expression\0result".
+Array<char *> speculationQueue;
+UIElement *speculationElement;
+
+#define SPECULATION_LINES (4) // The number of lines after the current line to speculatively evaluate.
+
+const char *ExpressionCacheFind(const char *expression) {
+	// Returns "" if the expression could not be evaluated, or nullptr if it hasn't been evaluated yet.
+	size_t bytes = strlen(expression);
+	uint64_t key = Hash((const uint8_t *) expression, bytes) | 1;
+	if (!expressionCache.Has(key)) return nullptr;
+	const char *entry = expressionCache.Get(key);
+	return strcmp(entry, expression) ? nullptr : entry + bytes + 1;
 }
 
-void InspectCurrentLine() {
-	for (int i = 0; i < inspectResults.Length(); i++) free(inspectResults[i]);
-	inspectResults.Free();
+void ExpressionCachePut(const char *expression, const char *result, size_t resultBytes) {
+	size_t bytes = strlen(expression);
+	uint64_t key = Hash((const uint8_t *) expression, bytes) | 1;
+	if (expressionCache.Has(key)) free(expressionCache.Get(key));
+	char *entry = (char *) malloc(bytes + resultBytes + 2);
+	memcpy(entry, expression, bytes + 1);
+	memcpy(entry + bytes + 1, result, resultBytes);
+	entry[bytes + resultBytes + 1] = 0;
+	expressionCache.Put(key, entry);
+}
 
-	UICodeLine *line = &displayCode->lines[currentLine - 1];
-	const char *string = displayCode->content + line->offset;
+void ExpressionCacheClear() {
+	for (uintptr_t i = 0; i < expressionCache.capacity; i++) {
+		if (expressionCache.array[i].key) free(expressionCache.array[i].value);
+	}
 
-	for (int i = 0; i < line->bytes; i++) {
-		if ((i != line->bytes - 1 && InspectIsTokenCharacter(string[i]) && !InspectIsTokenCharacter(string[i + 1])) || string[i] == ']') {
-			int b = 0, j = i;
+	expressionCache.Free();
+}
 
-			for (; j >= 0; j--) {
-				if (j && string[j] == '>' && string[j - 1] == '-') {
-					j--;
-				} else if (string[j] == ']') {
-					b++;
-				} else if (string[j] == '[' && b) {
-					b--;
-				} else if (InspectIsTokenCharacter(string[j]) || b || string[j] == '.') {
-				} else {
-					j++;
-					break;
-				}
-			}
+void ExpressionCacheEvaluate(char **expressions, int count) {
+	// Evaluate the expressions that aren't in the cache in one round trip. Duplicates are skipped by gf_print_all.
+	char buffer[16384];
+	int position = StringFormat(buffer, sizeof(buffer), "py gf_print_all([");
+	Array<char *> sent = {};
+
+	for (int i = 0; i < count; i++) {
+		int bytes = strlen(expressions[i]);
+		if (ExpressionCacheFind(expressions[i])) continue;
+		if (position + bytes * 2 + 8 > (int) sizeof(buffer)) break;
+		buffer[position++] = '\'';
+
+		for (int j = 0; j < bytes; j++) {
+			char c = expressions[i][j];
+			if (c == '\'' || c == '\\') buffer[position++] = '\\';
+			buffer[position++] = c;
+		}
 
-			char buffer[256];
-			if (i - j + 1 > 255 || j < 1) continue;
-			StringFormat(buffer, sizeof(buffer), "%.*s", i - j + 1, string + j);
+		buffer[position++] = '\'';
+		buffer[position++] = ',';
+		sent.Add(expressions[i]);
+	}
 
-			if (0 == strcmp(buffer, "true") || 0 == strcmp(buffer, "false") || 0 == strcmp(buffer, "if") || 0 == strcmp(buffer, "for")
-					|| 0 == strcmp(buffer, "else") || 0 == strcmp(buffer, "while") || 0 == strcmp(buffer, "int")
-					|| 0 == strcmp(buffer, "char") || 0 == strcmp(buffer, "switch") || 0 == strcmp(buffer, "float")) {
-				continue;
-			}
+	if (sent.Length()) {
+		StringFormat(buffer + position, sizeof(buffer) - position, "])");
+		EvaluateCommand(buffer);
 
-			bool match = false;
+		for (const char *line = evaluateResult; *line >= '0' && *line <= '9'; ) {
+			char *end;
+			int i = strtol(line, &end, 10);
+			const char *next = strchr(end, '\n');
+			if (*end != '\t' || !next || i >= sent.Length()) break;
+			ExpressionCachePut(sent[i], end + 1, next - end - 1);
+			line = next + 1;
+		}
 
-			for (int k = 0; k < inspectResults.Length(); k += 2) {
-				if (0 == strcmp(inspectResults[k], buffer)) {
-					match = true;
-				}
+		for (int i = 0; i < sent.Length(); i++) {
+			if (!ExpressionCacheFind(sent[i])) {
+				ExpressionCachePut(sent[i], "", 0);
 			}
+		}
+	}
+
+	sent.Free();
+}
+
+void SourceLineExpressions(int line, Array<char *> *expressions) {
+	// Get the expressions inspect line mode would show for the line, using the source index if it's ready.
+	const char *string = displayCode->content + displayCode->lines[line - 1].offset;
+	Array<SourceIndexSpan> found = {};
+	SourceIndexSpan *spans;
+	int spanCount;
+	SourceIndex *index = SourceIndexCurrent();
+
+	if (index && line <= index->lines.Length()) {
+		spans = &index->expressions[index->lines[line - 1].expressionsStart];
+		spanCount = index->lines[line - 1].expressionsCount;
+	} else {
+		SourceFindExpressions(string, displayCode->lines[line - 1].bytes, &found);
+		spans = found.array;
+		spanCount = found.Length();
+	}
+
+	for (int i = 0; i < spanCount; i++) {
+		expressions->Add(strndup(string + spans[i].offset, spans[i].bytes));
+	}
+
+	found.Free();
+}
+
+bool SpeculationIsSafe(const char *expression) {
+	// Only identifiers and member accesses are evaluated without the user asking for them.
+	// Anything else, such as an index or a call, could change the state of the program.
+	for (const char *c = expression; *c; c++) {
+		if (c[0] == '-' && c[1] == '>') c++;
+		else if (!InspectIsTokenCharacter(*c) && !isdigit(*c) && *c != '.') return false;
+	}
+
+	return true;
+}
+
+void SpeculationCancel() {
+	for (int i = 0; i < speculationQueue.Length(); i++) free(speculationQueue[i]);
+	speculationQueue.Free();
+	if (speculationElement) UIElementAnimate(speculationElement, true);
+}
+
+int SpeculationMessage(UIElement *element, UIMessage message, int di, void *dp) {
+	if (message == UI_MSG_ANIMATE) {
+		if (programRunning || !speculationQueue.Length()) {
+			SpeculationCancel();
+		} else {
+			// GDB can only run one command at a time, so a command from the user has to wait for the current evaluation.
+			// Evaluating a single expression each time keeps that wait short.
+			ExpressionCacheEvaluate(speculationQueue.array, 1);
+			free(speculationQueue[0]);
+			speculationQueue.Delete(0);
+		}
+	}
+
+	return 0;
+}
+
+void SpeculationStart() {
+	// While the interface is idle, evaluate the expressions on the lines around the current line,
+	// so that inspect line mode can show them immediately. Any command sent to GDB cancels this.
+	SpeculationCancel();
+	if (programRunning || showingDisassembly || !displayCodeShowsFile) return;
+	if (!currentLine || currentLine - 1 >= displayCode->lineCount) return;
 
-			if (match) continue;
+	for (int line = currentLine; line <= currentLine + SPECULATION_LINES && line <= displayCode->lineCount; line++) {
+		SourceLineExpressions(line, &speculationQueue);
+	}
 
-			const char *result = EvaluateExpression(buffer);
-			if (!result) continue;
-			if (0 == memcmp(result, "= {", 3) && !strchr(result + 3, '=')) continue;
-			inspectResults.Add(strdup(buffer));
-			inspectResults.Add(strdup(result));
+	for (int i = 0; i < speculationQueue.Length(); i++) {
+		if (ExpressionCacheFind(speculationQueue[i]) || !SpeculationIsSafe(speculationQueue[i])) {
+			free(speculationQueue[i]);
+			speculationQueue.Delete(i--);
 		}
 	}
 
+	if (!speculationQueue.Length()) return;
+
+	if (!speculationElement) {
+		speculationElement = UIElementCreate(sizeof(UIElement), &windowMain->e, UI_ELEMENT_HIDE, SpeculationMessage, "Speculation");
+	}
+
+	UIElementAnimate(speculationElement, false);
+}
+
+void InspectCurrentLine() {
+	for (int i = 0; i < inspectResults.Length(); i++) free(inspectResults[i]);
+	inspectResults.Free();
+
+	Array<char *> expressions = {};
+	SourceLineExpressions(currentLine, &expressions);
+	ExpressionCacheEvaluate(expressions.array, expressions.Length());
+
+	MapShort<const char *, bool> shown = {}; // Repeated expressions share a cache entry.
+
+	for (int i = 0; i < expressions.Length(); i++) {
+		const char *result = ExpressionCacheFind(expressions[i]);
+		if (!result || !result[0] || shown.Has(result)) continue;
+		shown.Put(result, true);
+		if (0 == memcmp(result, "= {", 3) && !strchr(result + 3, '=')) continue;
+		inspectResults.Add(strdup(expressions[i]));
+		inspectResults.Add(strdup(result));
+	}
+
+	for (int i = 0; i < expressions.Length(); i++) free(expressions[i]);
+	expressions.Free();
+	shown.Free();
+
 	if (!inspectResults.Length()) {
 		inspectResults.Add(strdup("No expressions to display."));
 		inspectResults.Add(strdup(" "));
@@ -964,12 +1804,7 @@ void CommandNextCommand(void *) {
 }
 
 void CommandClearOutput(void *) {
-	UI_FREE(displayOutput->content);
-	UI_FREE(displayOutput->lines);
-	displayOutput->content = NULL;
-	displayOutput->lines = NULL;
-	displayOutput->contentBytes = 0;
-	displayOutput->lineCount = 0;
+	UICodeInsertContent(displayOutput, "", 0, true);
 	UIElementRefresh(&displayOutput->e);
 }
 
@@ -1384,6 +2219,10 @@ void WatchAddExpression(WatchWindow *w, char *string = nullptr, bool selectNextR
 		if (end) *end = 0;
 		watch->hasFields = WatchHasFields(watch);
 	}
+
+	// The expression may have changed the state of the program, such as when it assigns a value.
+	ExpressionCacheClear();
+	SpeculationStart();
 }
 
 void WatchAddExpression2(char *string) {
@@ -1679,10 +2518,12 @@ bool WatchLoggerUpdate(char *data) {
 	strcpy(entry.value, value);
 	strcpy(entry.where, where);
 	Array<StackEntry> previousStack = stack;
+	bool previousHasMore = stackHasMore;
 	stack = {};
 	DebuggerGetStack();
 	entry.trace = stack;
 	stack = previousStack;
+	stackHasMore = previousHasMore;
 	logger->entries.Add(entry);
 	logger->table->itemCount++;
 	UIElementRefresh(&logger->table->e);
@@ -2293,7 +3134,25 @@ void CommandAddWatch(void *) {
 // Stack window:
 //////////////////////////////////////////////////////
 
+void StackLoadFrames(UITable *table, int index) {
+	// Page in older frames until the row at index is available.
+	bool changed = false;
+
+	while (!programRunning && stackHasMore && index >= stack.Length()) {
+		if (!DebuggerGetStackPage()) break;
+		changed = true;
+	}
+
+	if (changed) {
+		table->itemCount = stack.Length();
+		UITableResizeColumns(table);
+		UIElementRefresh(&table->e);
+	}
+}
+
 void StackSetFrame(UIElement *element, int index) {
+	StackLoadFrames((UITable *) element, index);
+
 	if (index >= 0 && index < ((UITable *) element)->itemCount && stackSelected != index) {
 		char buffer[64];
 		StringFormat(buffer, 64, "frame %d", index);
@@ -2329,6 +3188,11 @@ int TableStackMessage(UIElement *element, UIMessage message, int di, void *dp) {
 			// TODO Scroll the row into view if necessary.
 			return 1;
 		}
+	} else if (message == UI_MSG_SCROLLED) {
+		UITable *table = (UITable *) element;
+		int rowHeight = UI_SIZE_TABLE_ROW * element->window->scale;
+		int lastVisible = (table->vScroll->position + table->vScroll->page) / rowHeight;
+		StackLoadFrames(table, lastVisible + 1);
 	}
 
 	return 0;
@@ -2345,6 +3209,7 @@ void StackWindowUpdate(const char *, UIElement *_table) {
 	table->itemCount = stack.Length();
 	UITableResizeColumns(table);
 	UIElementRefresh(&table->e);
+	StackLoadFrames(table, UI_RECT_HEIGHT(table->e.bounds) / (int) (UI_SIZE_TABLE_ROW * table->e.window->scale));
 }
 
 //////////////////////////////////////////////////////
@@ -2720,29 +3585,73 @@ UIElement *FilesWindowCreate(UIElement *parent) {
 	return &container->e;
 }
 
-//////////////////////////////////////////////////////
-// Registers window:
-//////////////////////////////////////////////////////
+//////////////////////////////////////////////////////
+// Registers window:
+//////////////////////////////////////////////////////
+
+struct RegisterRow {
+	char name[32];
+	char value[64];
+	char natural[256];
+	bool modified;
+};
+
+struct RegisterGroup {
+	const char *name;
+	bool expanded;
+	bool fetched; // Whether the values are from the current stop; collapsed groups aren't refetched, so they become stale.
+	Array<RegisterRow> registers; // Kept between updates, so that values can be compared by name.
+};
+
+// Groups that have never been expanded aren't fetched.
+RegisterGroup registerGroups[] = {
+	{ "general", true },
+	{ "float" },
+	{ "vector" },
+	{ "system" },
+};
+
+#define REGISTER_GROUP_COUNT (sizeof(registerGroups) / sizeof(registerGroups[0]))
+
+RegisterRow *RegistersFindRow(int index, RegisterGroup **group) {
+	// Returns nullptr for a group header row.
+	for (uintptr_t i = 0; i < REGISTER_GROUP_COUNT; i++) {
+		*group = &registerGroups[i];
+		if (!index) return nullptr;
+		index--;
+		int count = (*group)->expanded ? (*group)->registers.Length() : 0;
+		if (index < count) return &(*group)->registers[index];
+		index -= count;
+	}
+
+	*group = nullptr;
+	return nullptr;
+}
+
+void RegistersTableRefresh(UITable *table) {
+	table->itemCount = REGISTER_GROUP_COUNT;
 
-struct RegisterData { char string[128]; };
-Array<RegisterData> registerData;
+	for (uintptr_t i = 0; i < REGISTER_GROUP_COUNT; i++) {
+		if (registerGroups[i].expanded) table->itemCount += registerGroups[i].registers.Length();
+	}
 
-UIElement *RegistersWindowCreate(UIElement *parent) {
-	return &UIPanelCreate(parent, UI_PANEL_SMALL_SPACING | UI_PANEL_COLOR_1 | UI_PANEL_SCROLL)->e;
+	UITableResizeColumns(table);
+	UIElementRefresh(&table->e);
 }
 
-void RegistersWindowUpdate(const char *, UIElement *panel) {
-	EvaluateCommand("info registers");
+bool RegistersGroupFetch(RegisterGroup *group) {
+	// Returns false if the program has no registers.
+	char buffer[64];
+	StringFormat(buffer, sizeof(buffer), "info registers %s", group->name);
+	EvaluateCommand(buffer);
 
 	if (strstr(evaluateResult, "The program has no registers now.")
 			|| strstr(evaluateResult, "The current thread has terminated")) {
-		return;
+		return false;
 	}
 
-	UIElementDestroyDescendents(panel);
 	char *position = evaluateResult;
-	Array<RegisterData> newRegisterData = {};
-	bool anyChanges = false;
+	Array<RegisterRow> registers = {};
 
 	while (*position != '(') {
 		char *nameStart = position;
@@ -2758,34 +3667,97 @@ void RegistersWindowUpdate(const char *, UIElement *panel) {
 		char *format2End = position = strchr(format2Start, '\n');
 		if (!format2End) break;
 
-		char *stringStart = nameStart;
-		char *stringEnd = format2End;
+		RegisterRow row = {};
+		StringFormat(row.name, sizeof(row.name), "%.*s", (int) (nameEnd - nameStart), nameStart);
 
-		RegisterData data;
-		StringFormat(data.string, sizeof(data.string), "%.*s",
-				(int) (stringEnd - stringStart), stringStart);
-		bool modified = false;
+		if (*format1Start == '{') {
+			// Vector registers only have the union of their views.
+			StringFormat(row.natural, sizeof(row.natural), "%.*s", (int) (format2End - format1Start), format1Start);
+		} else {
+			StringFormat(row.value, sizeof(row.value), "%.*s", (int) (format1End - format1Start), format1Start);
+			StringFormat(row.natural, sizeof(row.natural), "%.*s", (int) (format2End - format2Start), format2Start);
+		}
 
-		if (registerData.Length() > newRegisterData.Length()) {
-			RegisterData *old = &registerData[newRegisterData.Length()];
+		// The register set rarely changes, so first try the row at the same index before searching by name.
+		RegisterRow *old = nullptr;
+		int index = registers.Length();
 
-			if (strcmp(old->string, data.string)) {
-				modified = true;
+		if (index < group->registers.Length() && 0 == strcmp(group->registers[index].name, row.name)) {
+			old = &group->registers[index];
+		} else {
+			for (int j = 0; j < group->registers.Length(); j++) {
+				if (0 == strcmp(group->registers[j].name, row.name)) {
+					old = &group->registers[j];
+					break;
+				}
 			}
 		}
 
-		newRegisterData.Add(data);
+		row.modified = old && (strcmp(old->value, row.value) || strcmp(old->natural, row.natural));
+		registers.Add(row);
+	}
+
+	group->registers.Free();
+	group->registers = registers;
+	group->fetched = true;
+	return true;
+}
+
+int RegistersTableMessage(UIElement *element, UIMessage message, int di, void *dp) {
+	if (message == UI_MSG_TABLE_GET_ITEM) {
+		UITableGetItem *m = (UITableGetItem *) dp;
+		RegisterGroup *group;
+		RegisterRow *row = RegistersFindRow(m->index, &group);
+		if (!group) return 0;
+
+		if (!row) {
+			if (m->column == 0) return StringFormat(m->buffer, m->bufferBytes, "%c %s", group->expanded ? '-' : '+', group->name);
+			return 0;
+		}
+
+		m->isHighlighted = row->modified;
+
+		switch (m->column) {
+		case 0: return StringFormat(m->buffer, m->bufferBytes, "%s", row->name);
+		case 1: return StringFormat(m->buffer, m->bufferBytes, "%s", row->value);
+		case 2: return StringFormat(m->buffer, m->bufferBytes, "%s", row->natural);
+		}
+	} else if (message == UI_MSG_LEFT_DOWN) {
+		int index = UITableHitTest((UITable *) element, element->window->cursorX, element->window->cursorY);
+		RegisterGroup *group;
+
+		if (index != -1 && !RegistersFindRow(index, &group) && group) {
+			// Stale groups are fetched when they're expanded; rows are then marked with the changes since the group was last shown.
+			group->expanded = !group->expanded;
+			if (group->expanded && !group->fetched && !programRunning) RegistersGroupFetch(group);
+			RegistersTableRefresh((UITable *) element);
+		}
+	}
+
+	return 0;
+}
+
+UIElement *RegistersWindowCreate(UIElement *parent) {
+	UITable *table = UITableCreate(parent, 0, "Name\tValue\tNatural");
+	table->e.messageUser = RegistersTableMessage;
+	return &table->e;
+}
+
+void RegistersWindowUpdate(const char *, UIElement *table) {
+	bool anyChanges = false;
 
-		UIPanel *row = UIPanelCreate(panel, UI_PANEL_HORIZONTAL | UI_ELEMENT_H_FILL);
-		if (modified) row->e.messageUser = ModifiedRowMessage;
-		UILabelCreate(&row->e, 0, stringStart, stringEnd - stringStart);
+	for (uintptr_t i = 0; i < REGISTER_GROUP_COUNT; i++) {
+		RegisterGroup *group = &registerGroups[i];
+		group->fetched = false;
+		if (!group->expanded) continue;
+		if (!RegistersGroupFetch(group)) return;
+		if (!showingDisassembly) continue;
 
-		bool isPC = false;
-		if (nameEnd == nameStart + 3 && 0 == memcmp(nameStart, "rip", 3)) isPC = true;
-		if (nameEnd == nameStart + 3 && 0 == memcmp(nameStart, "eip", 3)) isPC = true;
-		if (nameEnd == nameStart + 2 && 0 == memcmp(nameStart,  "ip", 2)) isPC = true;
+		for (int j = 0; j < group->registers.Length(); j++) {
+			RegisterRow *row = &group->registers[j];
+			bool isPC = 0 == strcmp(row->name, "rip") || 0 == strcmp(row->name, "eip") || 0 == strcmp(row->name, "ip");
+			if (!row->modified || isPC) continue;
 
-		if (modified && showingDisassembly && !isPC) {
 			if (!anyChanges) {
 				autoPrintResult[0] = 0;
 				autoPrintResultLine = autoPrintExpressionLine;
@@ -2796,15 +3768,178 @@ void RegistersWindowUpdate(const char *, UIElement *panel) {
 			}
 
 			int position = strlen(autoPrintResult);
-			StringFormat(autoPrintResult + position, sizeof(autoPrintResult) - position, "%.*s=%.*s",
-					(int) (nameEnd - nameStart), nameStart,
-					(int) (format1End - format1Start), format1Start);
+			StringFormat(autoPrintResult + position, sizeof(autoPrintResult) - position, "%s=%s", row->name, row->value);
+		}
+	}
+
+	RegistersTableRefresh((UITable *) table);
+}
+
+//////////////////////////////////////////////////////
+// Vector registers window:
+//////////////////////////////////////////////////////
+
+struct VectorRegister {
+	char name[16];
+	uint8_t bytes[64], previous[64];
+	int byteCount;
+	bool hasPrevious;
+};
+
+struct VectorLaneFormat {
+	const char *name;
+	int bytes;
+	bool isFloat;
+	UIButton *button;
+};
+
+VectorLaneFormat vectorLaneFormats[] = {
+	{ "i8", 1 }, { "i16", 2 }, { "i32", 4 }, { "i64", 8 }, { "f32", 4, true }, { "f64", 8, true },
+};
+
+#define VECTOR_LANE_FORMAT_COUNT (sizeof(vectorLaneFormats) / sizeof(vectorLaneFormats[0]))
+
+Array<VectorRegister> vectorRegisters;
+VectorLaneFormat *vectorLaneFormat = &vectorLaneFormats[2];
+UITable *vectorRegistersTable;
+
+int VectorRegisterLaneToString(VectorRegister *reg, int lane, char *buffer, size_t bufferBytes) {
+	const uint8_t *bytes = reg->bytes;
+	int offset = lane * vectorLaneFormat->bytes;
+	bool changed = reg->hasPrevious && memcmp(reg->bytes + offset, reg->previous + offset, vectorLaneFormat->bytes);
+	const char *suffix = changed ? "*" : "";
+
+	if (vectorLaneFormat->bytes == 1) {
+		return StringFormat(buffer, bufferBytes, "%d%s", (int8_t) bytes[offset], suffix);
+	} else if (vectorLaneFormat->bytes == 2) {
+		int16_t x; memcpy(&x, bytes + offset, 2);
+		return StringFormat(buffer, bufferBytes, "%d%s", x, suffix);
+	} else if (vectorLaneFormat->bytes == 4 && !vectorLaneFormat->isFloat) {
+		int32_t x; memcpy(&x, bytes + offset, 4);
+		return StringFormat(buffer, bufferBytes, "%d%s", x, suffix);
+	} else if (vectorLaneFormat->bytes == 8 && !vectorLaneFormat->isFloat) {
+		int64_t x; memcpy(&x, bytes + offset, 8);
+		return StringFormat(buffer, bufferBytes, "%ld%s", x, suffix);
+	} else if (vectorLaneFormat->bytes == 4) {
+		float x; memcpy(&x, bytes + offset, 4);
+		return StringFormat(buffer, bufferBytes, "%g%s", x, suffix);
+	} else {
+		double x; memcpy(&x, bytes + offset, 8);
+		return StringFormat(buffer, bufferBytes, "%g%s", x, suffix);
+	}
+}
+
+int VectorRegistersTableMessage(UIElement *element, UIMessage message, int di, void *dp) {
+	if (message == UI_MSG_TABLE_GET_ITEM) {
+		UITableGetItem *m = (UITableGetItem *) dp;
+		VectorRegister *reg = &vectorRegisters[m->index];
+		m->isHighlighted = reg->hasPrevious && memcmp(reg->bytes, reg->previous, reg->byteCount);
+		if (m->column == 0) return StringFormat(m->buffer, m->bufferBytes, "%s", reg->name);
+		int lane = m->column - 1;
+		if ((lane + 1) * vectorLaneFormat->bytes > reg->byteCount) return 0;
+		return VectorRegisterLaneToString(reg, lane, m->buffer, m->bufferBytes);
+	}
+
+	return 0;
+}
+
+void VectorRegistersTableRefresh() {
+	// One column per lane of the widest register.
+	int byteCount = 0;
+
+	for (int i = 0; i < vectorRegisters.Length(); i++) {
+		if (vectorRegisters[i].byteCount > byteCount) byteCount = vectorRegisters[i].byteCount;
+	}
+
+	char columns[1024];
+	int position = StringFormat(columns, sizeof(columns), "Register");
+
+	for (int i = 0; i < byteCount / vectorLaneFormat->bytes; i++) {
+		position += StringFormat(columns + position, sizeof(columns) - position, "\t%d", i);
+	}
+
+	UI_FREE(vectorRegistersTable->columns);
+	vectorRegistersTable->columns = UIStringCopy(columns, -1);
+	vectorRegistersTable->itemCount = vectorRegisters.Length();
+	UITableResizeColumns(vectorRegistersTable);
+	UIElementRefresh(&vectorRegistersTable->e);
+}
+
+void VectorRegistersSetFormat(void *cp) {
+	vectorLaneFormat = (VectorLaneFormat *) cp;
+
+	for (uintptr_t i = 0; i < VECTOR_LANE_FORMAT_COUNT; i++) {
+		if (&vectorLaneFormats[i] == vectorLaneFormat) vectorLaneFormats[i].button->e.flags |= UI_BUTTON_CHECKED;
+		else vectorLaneFormats[i].button->e.flags &= ~UI_BUTTON_CHECKED;
+		UIElementRepaint(&vectorLaneFormats[i].button->e, nullptr);
+	}
+
+	VectorRegistersTableRefresh();
+}
+
+UIElement *VectorRegistersWindowCreate(UIElement *parent) {
+	UIPanel *panel = UIPanelCreate(parent, UI_PANEL_EXPAND);
+	UIPanel *toolbar = UIPanelCreate(&panel->e, UI_PANEL_COLOR_1 | UI_PANEL_HORIZONTAL | UI_PANEL_SMALL_SPACING);
+
+	for (uintptr_t i = 0; i < VECTOR_LANE_FORMAT_COUNT; i++) {
+		UIButton *button = UIButtonCreate(&toolbar->e, UI_BUTTON_SMALL, vectorLaneFormats[i].name, -1);
+		if (&vectorLaneFormats[i] == vectorLaneFormat) button->e.flags |= UI_BUTTON_CHECKED;
+		button->e.cp = &vectorLaneFormats[i];
+		button->invoke = VectorRegistersSetFormat;
+		vectorLaneFormats[i].button = button;
+	}
+
+	vectorRegistersTable = UITableCreate(&panel->e, UI_ELEMENT_V_FILL, "Register");
+	vectorRegistersTable->e.messageUser = VectorRegistersTableMessage;
+	return &panel->e;
+}
+
+void VectorRegistersWindowUpdate(const char *, UIElement *) {
+	// The raw bytes of all the vector registers are fetched in one batch,
+	// and the lanes are decoded here, so changing the format doesn't need GDB.
+	EvaluateCommand("py gf_vector_registers()");
+	Array<VectorRegister> registers = {};
+
+	for (const char *line = evaluateResult; *line && *line != '('; ) {
+		const char *tab = strchr(line, '\t');
+		const char *next = strchr(line, '\n');
+		if (!tab || !next || tab > next) break;
+
+		VectorRegister reg = {};
+		StringFormat(reg.name, sizeof(reg.name), "%.*s", (int) (tab - line), line);
+
+		for (const char *hex = tab + 1; hex + 1 < next && reg.byteCount < (int) sizeof(reg.bytes); hex += 2) {
+			char pair[3] = { hex[0], hex[1], 0 };
+			reg.bytes[reg.byteCount++] = strtoul(pair, nullptr, 16);
+		}
+
+		// Compare against the previous stop by name; the register set rarely changes, so try the same index first.
+		int index = registers.Length();
+		VectorRegister *old = nullptr;
+
+		if (index < vectorRegisters.Length() && 0 == strcmp(vectorRegisters[index].name, reg.name)) {
+			old = &vectorRegisters[index];
+		} else {
+			for (int i = 0; i < vectorRegisters.Length(); i++) {
+				if (0 == strcmp(vectorRegisters[i].name, reg.name)) {
+					old = &vectorRegisters[i];
+					break;
+				}
+			}
+		}
+
+		if (old && old->byteCount == reg.byteCount) {
+			memcpy(reg.previous, old->bytes, sizeof(reg.previous));
+			reg.hasPrevious = true;
 		}
+
+		registers.Add(reg);
+		line = next + 1;
 	}
 
-	UIElementRefresh(panel);
-	registerData.Free();
-	registerData = newRegisterData;
+	vectorRegisters.Free();
+	vectorRegisters = registers;
+	VectorRegistersTableRefresh();
 }
 
 //////////////////////////////////////////////////////
@@ -2886,13 +4021,106 @@ struct Thread {
 	char frame[127];
 	char name[16];
 	bool active;
+	bool hasFrame; // The frame is fetched when the row first becomes visible.
 	int id;
 };
 
 struct ThreadWindow {
-	Array<Thread> threads;
+	Array<Thread> threads; // Sorted by id.
+	int columnBytes[3];
+	bool fetchQueued;
 };
 
+void ThreadWindowResizeColumns(UITable *table, ThreadWindow *window) {
+	// Column widths are tracked as threads are added and frames are fetched,
+	// so that we don't have to measure every row of the table.
+	int itemCount = table->itemCount;
+	table->itemCount = 0;
+	UITableResizeColumns(table);
+	table->itemCount = itemCount;
+
+	for (int i = 0; i < table->columnCount && i < 3; i++) {
+		int width = window->columnBytes[i] * ui.activeFont->glyphWidth;
+		if (width > table->columnWidths[i]) table->columnWidths[i] = width;
+	}
+}
+
+Thread *ThreadFind(ThreadWindow *window, int id) {
+	int low = 0, high = window->threads.Length() - 1;
+
+	while (low <= high) {
+		int middle = (low + high) / 2;
+		if (window->threads[middle].id == id) return &window->threads[middle];
+		else if (window->threads[middle].id < id) low = middle + 1;
+		else high = middle - 1;
+	}
+
+	return nullptr;
+}
+
+bool ThreadVisibleRange(UITable *table, int *first, int *last) {
+	if (programRunning || !table->itemCount) return false;
+	int rowHeight = UI_SIZE_TABLE_ROW * table->e.window->scale;
+	*first = table->vScroll->position / rowHeight;
+	*last = *first + UI_RECT_HEIGHT(table->e.bounds) / rowHeight + 1;
+	if (*last >= table->itemCount) *last = table->itemCount - 1;
+	return *first <= *last;
+}
+
+void ThreadFetchVisibleFrames(char *_table) {
+	UITable *table = (UITable *) _table;
+	ThreadWindow *window = (ThreadWindow *) table->e.cp;
+	window->fetchQueued = false;
+	int first, last;
+	if (!ThreadVisibleRange(table, &first, &last)) return;
+
+	char buffer[4096];
+	int position = StringFormat(buffer, sizeof(buffer), "py gf_thread_frames([");
+	bool any = false;
+
+	for (int i = first; i <= last && position < (int) sizeof(buffer) - 16; i++) {
+		if (window->threads[i].hasFrame) continue;
+		position += StringFormat(buffer + position, sizeof(buffer) - position, "%d,", window->threads[i].id);
+		any = true;
+	}
+
+	if (!any) return;
+	StringFormat(buffer + position, sizeof(buffer) - position, "])");
+	EvaluateCommand(buffer);
+
+	for (const char *line = evaluateResult; *line >= '0' && *line <= '9'; ) {
+		char *end;
+		Thread *thread = ThreadFind(window, strtol(line, &end, 10));
+		const char *next = strchr(end, '\n');
+		if (*end != '\t' || !next) break;
+
+		if (thread) {
+			StringFormat(thread->frame, sizeof(thread->frame), "%.*s", (int) (next - end - 1), end + 1);
+			thread->hasFrame = true;
+			int bytes = strlen(thread->frame);
+			if (bytes > window->columnBytes[2]) window->columnBytes[2] = bytes;
+		}
+
+		line = next + 1;
+	}
+
+	ThreadWindowResizeColumns(table, window);
+	UIElementRefresh(&table->e);
+}
+
+void ThreadQueueFetchVisibleFrames(UITable *table, ThreadWindow *window) {
+	// Called while painting, so the frames are fetched afterwards and the previous ones are shown meanwhile.
+	int first, last;
+	if (window->fetchQueued || !ThreadVisibleRange(table, &first, &last)) return;
+
+	for (int i = first; i <= last; i++) {
+		if (window->threads[i].hasFrame) continue;
+		window->fetchQueued = true;
+		UIWindowPostMessage(windowMain, msgThreadFetchVisible, table);
+		return;
+	}
+}
+
 int ThreadTableMessage(UIElement *element, UIMessage message, int di, void *dp) {
 	ThreadWindow *window = (ThreadWindow *) element->cp;
 
@@ -2905,6 +4133,8 @@ int ThreadTableMessage(UIElement *element, UIMessage message, int di, void *dp)
 		case 1: return StringFormat(m->buffer, m->bufferBytes, "%s", window->threads[m->index].name);
 		case 2: return StringFormat(m->buffer, m->bufferBytes, "%s", window->threads[m->index].frame);
 		}
+	} else if (message == UI_MSG_PAINT) {
+		ThreadQueueFetchVisibleFrames((UITable *) element, window);
 	} else if (message == UI_MSG_LEFT_DOWN) {
 		int index = UITableHitTest((UITable *) element, element->window->cursorX, element->window->cursorY);
 
@@ -2927,47 +4157,149 @@ UIElement *ThreadWindowCreate(UIElement *parent) {
 
 void ThreadWindowUpdate(const char *, UIElement *_table) {
 	ThreadWindow *window = (ThreadWindow *) _table->cp;
-	window->threads.length = 0;
+	EvaluateCommand("py gf_threads()");
+
+	// Merge the new list into the existing one by thread id; both are sorted.
+	// Frames are refetched when their rows become visible, since every thread may have moved while the program was running.
+	// Until then, the previous frame is kept so that the row doesn't flicker.
+	Array<Thread> threads = {};
+	int oldIndex = 0;
+	window->columnBytes[0] = window->columnBytes[1] = window->columnBytes[2] = 0;
+
+	for (const char *line = evaluateResult; *line >= '0' && *line <= '9'; ) {
+		char *end;
+		int id = strtol(line, &end, 10);
+		const char *next = strchr(end, '\n');
+		if (*end != '\t' || !next) break;
+
+		while (oldIndex < window->threads.Length() && window->threads[oldIndex].id < id) oldIndex++;
+		Thread thread = {};
+		if (oldIndex < window->threads.Length() && window->threads[oldIndex].id == id) thread = window->threads[oldIndex];
+		thread.id = id;
+		thread.active = end[1] == '1';
+		thread.hasFrame = false;
+		StringFormat(thread.name, sizeof(thread.name), "%.*s", (int) (next - end - 3), end + 3);
+		threads.Add(thread);
+
+		int bytes[3] = { snprintf(nullptr, 0, "%d", id), (int) strlen(thread.name), (int) strlen(thread.frame) };
+		for (int i = 0; i < 3; i++) if (bytes[i] > window->columnBytes[i]) window->columnBytes[i] = bytes[i];
+		line = next + 1;
+	}
 
-	EvaluateCommand("info threads");
-	char *position = evaluateResult;
+	window->threads.Free();
+	window->threads = threads;
+
+	UITable *table = (UITable *) _table;
+	table->itemCount = window->threads.Length();
+	ThreadWindowResizeColumns(table, window);
+	UIElementRefresh(&table->e);
+}
+
+//////////////////////////////////////////////////////
+// Parallel stacks window:
+//////////////////////////////////////////////////////
+
+#define PARALLEL_STACKS_FRAME_LIMIT (1000)
+#define PARALLEL_STACKS_BATCH_MS (200)
+
+struct ParallelStacksNode {
+	char function[64];
+	char location[sizeof(previousLocation)];
+	int depth, threadCount;
+	int threadID, frameIndex; // One of the threads passing through this node, and the index of the frame in its stack.
+};
+
+struct ParallelStacksWindow {
+	Array<ParallelStacksNode> nodes; // The tree in depth-first order.
+	int selected;
+	bool skipNextUpdate;
+};
+
+int ParallelStacksTableMessage(UIElement *element, UIMessage message, int di, void *dp) {
+	ParallelStacksWindow *window = (ParallelStacksWindow *) element->cp;
 
-	for (int i = 0; position[i]; i++) {
-		if (position[i] == '\n' && position[i + 1] == ' ' && position[i + 2] == ' ' && position[i + 3] == ' ') {
-			memmove(position + i, position + i + 3, strlen(position) - 3 - i + 1);
+	if (message == UI_MSG_TABLE_GET_ITEM) {
+		UITableGetItem *m = (UITableGetItem *) dp;
+		ParallelStacksNode *node = &window->nodes[m->index];
+		m->isSelected = m->index == window->selected;
+
+		switch (m->column) {
+		case 0: return StringFormat(m->buffer, m->bufferBytes, "%d", node->threadCount);
+		case 1: return StringFormat(m->buffer, m->bufferBytes, "%*s%s", node->depth * 2, "", node->function);
+		case 2: return StringFormat(m->buffer, m->bufferBytes, "%s", node->location);
+		}
+	} else if (message == UI_MSG_LEFT_DOWN) {
+		int index = UITableHitTest((UITable *) element, element->window->cursorX, element->window->cursorY);
+
+		if (index != -1 && !programRunning) {
+			// Switching the thread and frame causes all windows to update, but the aggregated stacks haven't changed.
+			char buffer[64];
+			StringFormat(buffer, sizeof(buffer), "thread %d", window->nodes[index].threadID);
+			EvaluateCommand(buffer);
+			StringFormat(buffer, sizeof(buffer), "frame %d", window->nodes[index].frameIndex);
+			window->selected = index;
+			window->skipNextUpdate = true;
+			DebuggerSend(buffer, true, false);
+			UIElementRepaint(element, nullptr);
 		}
 	}
 
-	while (true) {
-		position = strchr(position, '\n');
-		if (!position) break;
-		Thread thread = {};
-		if (position[1] == '*') thread.active = true;
-		thread.id = atoi(position + 2);
+	return 0;
+}
+
+UIElement *ParallelStacksWindowCreate(UIElement *parent) {
+	UITable *table = UITableCreate(parent, 0, "Threads\tFunction\tLocation");
+	table->e.cp = (ParallelStacksWindow *) calloc(1, sizeof(ParallelStacksWindow));
+	table->e.messageUser = ParallelStacksTableMessage;
+	return &table->e;
+}
+
+void ParallelStacksWindowUpdate(const char *, UIElement *_table) {
+	ParallelStacksWindow *window = (ParallelStacksWindow *) _table->cp;
 
-		position = strchr(position + 1, '"');
-		if (!position) break;
-		char *end = strchr(++position, '"');
-		if (!end) break;
-		if (end - position >= (ptrdiff_t)sizeof(thread.name))
-			end = position + sizeof(thread.name) - 1;
-		memcpy(thread.name, position, end - position);
-		thread.name[end - position] = 0;
+	if (window->skipNextUpdate) {
+		window->skipNextUpdate = false;
+		return;
+	}
 
-		position = end + 1;
-		while (*position == ' ') position++;
+	// The backtraces of all threads are collected and merged in Python, so the output is proportional to the number
+	// of distinct frames rather than the number of threads. Each call walks threads for up to PARALLEL_STACKS_BATCH_MS,
+	// keeping it well within the evaluation timeout, and says which thread the next call should continue from.
+	char buffer[64];
+	int start = 0;
 
-		end = strchr(position, '\n');
-		if (end - position >= (ptrdiff_t) sizeof(thread.frame))
-			end = position + sizeof(thread.frame) - 1;
-		memcpy(thread.frame, position, end - position);
-		thread.frame[end - position] = 0;
+	while (true) {
+		StringFormat(buffer, sizeof(buffer), "py gf_parallel_stacks(%d,%d,%d)", start, PARALLEL_STACKS_FRAME_LIMIT, PARALLEL_STACKS_BATCH_MS);
+		EvaluateCommand(buffer);
+		if (evaluateResult[0] != '+') break;
+		int next = atoi(evaluateResult + 1);
+		if (next <= start) break;
+		start = next;
+	}
 
-		window->threads.Add(thread);
+	window->nodes.Free();
+	window->selected = -1;
+
+	for (const char *line = evaluateResult; *line >= '0' && *line <= '9'; ) {
+		ParallelStacksNode node = {};
+		char *end;
+		node.depth = strtol(line, &end, 10);
+		node.threadCount = strtol(end + 1, &end, 10);
+		node.threadID = strtol(end + 1, &end, 10);
+		node.frameIndex = strtol(end + 1, &end, 10);
+		if (*end != '\t') break;
+		const char *function = end + 1;
+		const char *location = strchr(function, '\t');
+		const char *next = location ? strchr(location, '\n') : nullptr;
+		if (!next) break;
+		StringFormat(node.function, sizeof(node.function), "%.*s", (int) (location - function), function);
+		StringFormat(node.location, sizeof(node.location), "%.*s", (int) (next - location - 1), location + 1);
+		window->nodes.Add(node);
+		line = next + 1;
 	}
 
 	UITable *table = (UITable *) _table;
-	table->itemCount = window->threads.Length();
+	table->itemCount = window->nodes.Length();
 	UITableResizeColumns(table);
 	UIElementRefresh(&table->e);
 }
@@ -3163,35 +4495,198 @@ UIElement *CommandSearchWindowCreate(UIElement *parent) {
 // ASM window:
 //////////////////////////////////////////////////////
 
+struct ASMLine {
+	uint64_t address; // For source lines, the address of the instruction that follows.
+	bool isInstruction;
+	char *text;
+};
+
+struct ASMWindow {
+	Array<ASMLine> lines; // Sorted by address.
+};
+
+#define ASM_WINDOW_FETCH_BYTES (128)
+#define ASM_WINDOW_MARGIN_BYTES (64) // Extend the window when $pc gets this close to its edges.
+#define ASM_WINDOW_MAXIMUM_LINES (4096)
+
+void ASMWindowClear(ASMWindow *window) {
+	for (int i = 0; i < window->lines.Length(); i++) free(window->lines[i].text);
+	window->lines.Free();
+}
+
+bool ASMWindowFetch(ASMWindow *window, uint64_t from, uint64_t to) {
+	// Disassemble the range, and add the instructions outside the current window.
+	char buffer[128];
+	StringFormat(buffer, sizeof(buffer), "disassemble /s 0x%lx,0x%lx", from, to);
+	EvaluateCommand(buffer);
+
+	if (strstr(evaluateResult, "No registers.") || strstr(evaluateResult, "The current thread has terminated")) {
+		return false;
+	}
+
+	char *start = strstr(evaluateResult, ":\n");
+	char *end = strstr(evaluateResult, "End of assembler dump.");
+	if (!start || !end || start > end) return false;
+
+	bool empty = !window->lines.Length();
+	uint64_t low = empty ? 0 : window->lines.First().address;
+	uint64_t high = empty ? 0 : window->lines.Last().address;
+	Array<ASMLine> fetched = {};
+	int pendingSource = 0;
+
+	for (char *line = start + 2, *next; line < end; line = next + 1) {
+		next = strchr(line, '\n');
+		if (!next || next > end) next = end;
+		bool isInstruction = next - line > 5 && (line[0] == ' ' || line[0] == '=') && line[3] == '0' && line[4] == 'x';
+		if (line[0] == '=') line[0] = line[1] = ' ';
+		ASMLine entry = { .address = isInstruction ? strtoull(line + 3, nullptr, 0) : 0, .isInstruction = isInstruction };
+
+		if (!isInstruction) {
+			fetched.Add(entry);
+			fetched.Last().text = strndup(line, next - line);
+			pendingSource++;
+			continue;
+		}
+
+		bool keep = empty || entry.address < low || entry.address > high;
+
+		for (int i = fetched.Length() - pendingSource; i < fetched.Length(); i++) {
+			// Source lines are attached to the instruction that follows them.
+			if (keep) fetched[i].address = entry.address;
+			else free(fetched[i].text);
+		}
+
+		if (!keep) fetched.Delete(fetched.Length() - pendingSource, pendingSource);
+		pendingSource = 0;
+
+		if (keep) {
+			entry.text = strndup(line, next - line);
+			fetched.Add(entry);
+		}
+	}
+
+	for (int i = fetched.Length() - pendingSource; i < fetched.Length(); i++) free(fetched[i].text);
+	fetched.Delete(fetched.Length() - pendingSource, pendingSource);
+
+	if (!empty && fetched.Length() && fetched.First().address < low) {
+		window->lines.InsertMany(fetched.array, 0, fetched.Length());
+	} else {
+		window->lines.AddMany(fetched.array, fetched.Length());
+	}
+
+	bool added = fetched.Length();
+	fetched.Free();
+	return added;
+}
+
+int ASMWindowFindLine(ASMWindow *window, uint64_t address) {
+	// Returns the 0-indexed line of the instruction at the address, or -1.
+	int low = 0, high = window->lines.Length();
+
+	while (low < high) {
+		int middle = (low + high) / 2;
+		if (window->lines[middle].address < address) low = middle + 1;
+		else high = middle;
+	}
+
+	while (low < window->lines.Length() && window->lines[low].address == address) {
+		if (window->lines[low].isInstruction) return low;
+		low++;
+	}
+
+	return -1;
+}
+
+int ASMWindowMessage(UIElement *element, UIMessage message, int di, void *dp) {
+	if (message == UI_MSG_DESTROY) {
+		ASMWindow *window = (ASMWindow *) element->cp;
+		ASMWindowClear(window);
+		free(window);
+		element->cp = nullptr;
+	}
+
+	return 0;
+}
+
 UIElement* ASMWindowCreate(UIElement *parent) {
 	UICode*	uiAsmCode = UICodeCreate(parent, selectableSource ? UI_CODE_SELECTABLE : 0);
 	uiAsmCode->centerExecutionPointer = true;
+	uiAsmCode->e.cp = (ASMWindow *) calloc(1, sizeof(ASMWindow));
+	uiAsmCode->e.messageUser = ASMWindowMessage;
 	return &uiAsmCode->e;
 }
 
-void ASMWindowUpdate(const char *data, UIElement *element) {
-	EvaluateCommand("disassemble /m $pc-128,$pc+128");
+void ASMWindowUpdate(const char *, UIElement *element) {
+	UICode *asmCode = (UICode *) element;
+	ASMWindow *window = (ASMWindow *) element->cp;
 
-	if (strstr(evaluateResult, "No registers.") || strstr(evaluateResult, "The current thread has terminated")) {
-		return;
-	} else {
-		UICode* asmCode = (UICode *) element;
-		UICodeInsertContent(asmCode, evaluateResult, -1, true);
-
-		char *current = strstr(evaluateResult, "=>");
-
-		if (current) {
-			int line = 0;
-			int lineHeight = UIMeasureStringHeight();
-			int viewHeight = UI_RECT_HEIGHT(asmCode->e.bounds);
-			
-			for (char *p = evaluateResult; p < current; p++) {
-				if (*p == '\n') line++;
-			}
-			
-			asmCode->vScroll->position = line * lineHeight - (viewHeight / 2);
+	EvaluateCommand("p $pc");
+	char *address = strstr(evaluateResult, "0x");
+	if (!address) return;
+	uint64_t pc = strtoull(address, nullptr, 0);
+	bool changed = false;
+
+	if (window->lines.Length() > ASM_WINDOW_MAXIMUM_LINES
+			|| (window->lines.Length() && (pc + ASM_WINDOW_FETCH_BYTES < window->lines.First().address
+					|| pc > window->lines.Last().address + ASM_WINDOW_FETCH_BYTES))) {
+		// $pc is far from the cached instructions.
+		ASMWindowClear(window);
+		changed = true;
+	}
+
+	for (int i = 0; i < 2; i++) {
+		if (!window->lines.Length()) {
+			uint64_t from = pc > ASM_WINDOW_FETCH_BYTES ? pc - ASM_WINDOW_FETCH_BYTES : 0;
+			if (!ASMWindowFetch(window, from, pc + ASM_WINDOW_FETCH_BYTES)) return;
+			changed = true;
+		}
+
+		// Extend the window on demand as $pc approaches its edges.
+
+		if (pc < window->lines.First().address + ASM_WINDOW_MARGIN_BYTES && window->lines.First().address > ASM_WINDOW_FETCH_BYTES) {
+			uint64_t low = window->lines.First().address;
+			changed |= ASMWindowFetch(window, low - ASM_WINDOW_FETCH_BYTES, low);
+		}
+
+		if (pc + ASM_WINDOW_MARGIN_BYTES > window->lines.Last().address) {
+			uint64_t high = window->lines.Last().address;
+			changed |= ASMWindowFetch(window, high, high + ASM_WINDOW_FETCH_BYTES);
 		}
+
+		if (ASMWindowFindLine(window, pc) != -1) break;
+
+		// $pc isn't on an instruction boundary we've decoded, so start again.
+		ASMWindowClear(window);
 	}
-	
+
+	int line = ASMWindowFindLine(window, pc);
+	if (line == -1) return;
+
+	if (changed) {
+		size_t bytes = 0;
+		for (int i = 0; i < window->lines.Length(); i++) bytes += strlen(window->lines[i].text) + 1;
+		char *buffer = (char *) malloc(bytes + 1);
+		size_t position = 0;
+
+		for (int i = 0; i < window->lines.Length(); i++) {
+			size_t lineBytes = strlen(window->lines[i].text);
+			memcpy(buffer + position, window->lines[i].text, lineBytes);
+			buffer[position + lineBytes] = '\n';
+			position += lineBytes + 1;
+		}
+
+		UICodeInsertContent(asmCode, buffer, position, true);
+		free(buffer);
+	}
+
+	UICodeFocusLine(asmCode, line + 1);
 	UIElementRefresh(element);
 }
+
+void ASMWindowsClear() {
+	// Called when the program is restarted, so that hidden windows don't keep instructions from the previous run.
+	for (int i = 0; i < interfaceWindows.Length(); i++) {
+		InterfaceWindow *window = &interfaceWindows[i];
+		if (window->update == ASMWindowUpdate && window->element) ASMWindowClear((ASMWindow *) window->element->cp);
+	}
+}